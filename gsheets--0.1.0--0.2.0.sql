@@ -0,0 +1,110 @@
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+\echo Use "ALTER EXTENSION gsheets UPDATE TO '0.2.0'" to load this file. \quit
+
+-- inferred column names and types of sheets, reused while the sheet's shape is unchanged
+CREATE TABLE gsheets_schema_cache (
+    spreadsheet_id text NOT NULL,
+    sheet_name text NOT NULL,
+    revision text NOT NULL,
+    column_names text[],
+    column_types regtype[] NOT NULL,
+    inferred_at timestamptz NOT NULL DEFAULT now(),
+    PRIMARY KEY (spreadsheet_id, sheet_name, revision)
+);
+
+-- Not accessible to other roles: schemas are only read for a known sheet,
+-- and only types that inference produces are stored, through these functions
+
+-- gsheets_lookup_schema(spreadsheet_id, sheet_name, revision)
+CREATE FUNCTION gsheets_lookup_schema(text, text, text)
+RETURNS regtype[]
+LANGUAGE sql STABLE SECURITY DEFINER
+SET search_path = pg_catalog, pg_temp
+AS $$
+SELECT c.column_types FROM @extschema@.gsheets_schema_cache c
+WHERE c.spreadsheet_id = $1 AND c.sheet_name = $2 AND c.revision = $3
+$$;
+
+-- gsheets_store_schema(spreadsheet_id, sheet_name, revision, column_names, column_types)
+CREATE FUNCTION gsheets_store_schema(text, text, text, text[], regtype[])
+RETURNS void
+LANGUAGE plpgsql SECURITY DEFINER
+SET search_path = pg_catalog, pg_temp
+AS $$
+BEGIN
+    IF $5 IS NULL OR NOT $5 <@ ARRAY['bigint', 'numeric', 'boolean', 'date', 'timestamp', 'time', 'text']::regtype[] THEN
+        RAISE EXCEPTION 'Invalid column types %', $5
+            USING ERRCODE = 'invalid_parameter_value';
+    END IF;
+
+    -- Concurrent inferences of the same sheet must not fail on the key
+    INSERT INTO @extschema@.gsheets_schema_cache AS c
+        (spreadsheet_id, sheet_name, revision, column_names, column_types)
+    VALUES ($1, $2, $3, $4, $5)
+    ON CONFLICT ON CONSTRAINT gsheets_schema_cache_pkey DO UPDATE
+        SET column_names = EXCLUDED.column_names,
+            column_types = EXCLUDED.column_types,
+            inferred_at = now();
+
+    DELETE FROM @extschema@.gsheets_schema_cache c
+    WHERE c.spreadsheet_id = $1 AND c.sheet_name = $2 AND c.revision <> $3;
+END
+$$;
+
+CREATE FUNCTION gsheets_http_stats(OUT requests bigint, OUT hedged bigint, OUT hedge_wins bigint)
+RETURNS record
+LANGUAGE c
+AS 'MODULE_PATHNAME';
+
+-- read_sheet gains a format argument
+DROP FUNCTION read_sheet(text, text, boolean);
+
+CREATE FUNCTION read_sheet(link text, sheet_name text DEFAULT 'Sheet1', header boolean DEFAULT true, format text DEFAULT 'json')
+RETURNS SETOF record
+LANGUAGE c
+AS 'MODULE_PATHNAME';
+
+-- The final function frees the aggregate state, which must be declared
+DROP AGGREGATE write_sheet(VARIADIC "any");
+
+CREATE AGGREGATE write_sheet(VARIADIC "any") (
+    sfunc = write_sheet_transition,
+    stype = internal,
+    finalfunc = write_sheet_final,
+    finalfunc_modify = read_write
+);
+
+CREATE FUNCTION gsheets_write_memory(OUT current_bytes bigint, OUT peak_bytes bigint)
+RETURNS record
+LANGUAGE c
+AS 'MODULE_PATHNAME';
+
+CREATE FUNCTION gsheets_fdw_handler()
+RETURNS fdw_handler
+LANGUAGE c
+AS 'MODULE_PATHNAME';
+
+CREATE FUNCTION gsheets_fdw_validator(text[], oid)
+RETURNS void
+LANGUAGE c
+AS 'MODULE_PATHNAME';
+
+CREATE FOREIGN DATA WRAPPER gsheets_fdw
+    HANDLER gsheets_fdw_handler
+    VALIDATOR gsheets_fdw_validator;
+
+-- Inspection of type inference and typed writes, used by the regression tests
+CREATE FUNCTION gsheets_cell_type(cell jsonb)
+RETURNS regtype
+LANGUAGE c IMMUTABLE STRICT
+AS 'MODULE_PATHNAME';
+
+CREATE FUNCTION gsheets_cell_value(value jsonb, type regtype)
+RETURNS text
+LANGUAGE c IMMUTABLE STRICT
+AS 'MODULE_PATHNAME';
+
+CREATE FUNCTION gsheets_typed_cell(value anyelement)
+RETURNS jsonb
+LANGUAGE c STABLE STRICT
+AS 'MODULE_PATHNAME';
@@ -1,40 +1,120 @@
 #include "postgres.h"
 
+#include <float.h>
+#include <math.h>
+
+#include "access/xact.h"
+#include "access/xlog.h"
+#include "catalog/pg_type.h"
+#include "common/hashfn.h"
+#include "executor/spi.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/csv_parser.h"
+#include "utils/date.h"
 #include "utils/guc.h"
-#include "utils/http_helpers.h"
+#include "utils/http_gateway.h"
+#include "utils/json.h"
 #include "utils/jsonb.h"
+#include "utils/tracing.h"
 #include "utils/typcache.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/wait_event.h"
 #include "miscadmin.h"
 #include "funcapi.h"
 
+#include "gsheets.h"
+
 #define BASE_URL "https://sheets.googleapis.com/v4/spreadsheets"
 #define SHEET_URL(id, range) psprintf("%s/%s/values/%s", BASE_URL, id, range)
+#define BATCH_URL(id) psprintf("%s/%s/values:batchGet", BASE_URL, id)
 #define METADATA_URL(id) psprintf("%s/%s", BASE_URL, id)
-#define TYPEINFER_FIELDS "sheets(data(rowData(values(userEnteredFormat%2FnumberFormat%2CuserEnteredValue))%2CstartColumn%2CstartRow))"
+#define EXPORT_URL(id) psprintf("https://docs.google.com/spreadsheets/d/%s/export", id)
+#define TYPEINFER_FIELDS "sheets(data(rowData(values(userEnteredFormat%2FnumberFormat%2CeffectiveValue))%2CstartColumn%2CstartRow))"
+#define TAB_FIELDS "sheets.properties(sheetId%2Ctitle%2CgridProperties(rowCount%2CcolumnCount))"
+#define CELL_FIELDS "userEnteredValue,userEnteredFormat.numberFormat"
+
+/* Days from the spreadsheet epoch, 1899-12-30, to the PostgreSQL epoch */
+#define SERIAL_EPOCH_OFFSET 36526
+
+/* Rows of one target tab */
+typedef struct write_target {
+    char *sheet_name;
+    StringInfoData rows;            /* JSON rows of the current batch, comma separated */
+    int count;                      /* rows in the current batch */
+    int written;                    /* rows already sent, including the header */
+    bool exists;                    /* the tab is known to exist */
+    int sheet_id;                   /* for typed writes, which address tabs by id */
+    int grid_rows;                  /* grid size of the tab, grown by typed writes */
+    int grid_cols;
+    int width;                      /* most cells in a row so far */
+} write_target;
 
 typedef struct write_state {
     int tcount;
-    int count;
-    char *sheet_name;
+    int pending;                    /* rows buffered over all targets */
+    char *sheet_name;               /* tab of rows that are not partitioned */
     char *spreadsheet_id;
-    StringInfoData buff;
+    char *header;                   /* header row as a JSON array or typed row, or NULL */
+    int header_width;
+    bool typed;                     /* send typed cells rather than strings */
+    char *partition_by;             /* column whose value names each row's tab */
+    int partition_attno;            /* its attribute number, 0 until resolved */
+    List *targets;
+    List *existing_tabs;            /* sheet_tabs present before a partitioned or typed write */
+    StringInfoData buff;            /* request body, rebuilt in place on every flush */
+    StringInfoData url;             /* request URL, likewise */
+    struct curl_slist *headers;     /* request headers, built once */
+    MemoryContext state_mcxt;       /* holds the state and everything it points to */
+    MemoryContext row_mcxt;         /* reset after every row and flush */
+    Oid out_type;                   /* type the output functions below are for */
+    int32 out_typmod;
+    int natts;
+    FmgrInfo *out_funcs;
+    Oid *att_types;                 /* base type of each attribute, for typed cells */
+    Datum *values;
+    bool *nulls;
 } write_state;
 
-static char *access_token = NULL;
+typedef struct csv_read_state {
+    Tuplestorestate *tupstore;
+    TupleDesc tupdesc;
+    FmgrInfo *in_funcs;
+    Oid *typioparams;
+    Datum *values;
+    bool *nulls;
+    bool skip_row;              /* drop the next row, used to skip the header */
+    MemoryContext row_mcxt;     /* reset after every row */
+} csv_read_state;
+
+char *access_token = NULL;
 static bool enable_infer_types = false;
+static bool enable_schema_cache = true;
+int infer_sample_rows = 10;
+
+/* Memory held by the running (or last) write_sheet, for gsheets_write_memory() */
+static int64 write_mem_current = 0;
+static int64 write_mem_peak = 0;
 
 static bool validate_url(const char *url);
+static Datum cell_datum(JsonbValue *cell, Oid typid, bool *isnull);
+static int sheet_gid(const char *id, const char *sheet, struct curl_slist *headers);
+static void read_sheet_csv(ReturnSetInfo *rsinfo, const char *id, const char *sheet, bool header,
+                           struct curl_slist *headers);
 static char *extract_id(const char* url);
-static List *infer_types(const char *id, const char *sheet, bool has_header);
+static List *infer_types(const char *id, const char *sheet, int first_row, int ncols,
+                         struct curl_slist *headers);
+static List *sheet_types(const char *id, const char *sheet, bool has_header, int start_row,
+                         JsonbValue *rows, struct curl_slist *headers);
 
-static void initialize_buffer(StringInfoData *buff);
-static void close_buffer(StringInfoData *buff);
 static void remove_trailing_comma(StringInfoData *buff);
 
 static void create_new_sheet(char **spreadsheet_id, char *spreadsheet_name);
-static void write_header(Jsonb *jb, write_state *state);
+static char *header_row(Jsonb *jb);
+static char *header_cells(Jsonb *jb, int *width);
+static bool extract_bool_from_jsonb(Jsonb *jb, char *field);
 static char *extract_text_from_jsonb(Jsonb *jb, char *field);
 static void write_to_gsheet(write_state *state);
 
@@ -64,8 +144,103 @@ void _PG_init(void)
                              NULL,
                              NULL,
                              NULL);
+    DefineCustomBoolVariable("gsheets.enable_schema_cache",
+                             "Reuse inferred column types stored in gsheets_schema_cache",
+                             NULL,
+                             &enable_schema_cache,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
+    DefineCustomIntVariable("gsheets.infer_sample_rows",
+                            "Number of rows sampled to infer column types",
+                            NULL,
+                            &infer_sample_rows,
+                            10,
+                            1,
+                            1000,
+                            PGC_USERSET,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomIntVariable("gsheets.connect_timeout",
+                            "Timeout for establishing a connection to Google",
+                            "Zero waits indefinitely.",
+                            &http_connect_timeout,
+                            10000,
+                            0,
+                            INT_MAX,
+                            PGC_USERSET,
+                            GUC_UNIT_MS,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomIntVariable("gsheets.request_timeout",
+                            "Timeout for a complete request to Google",
+                            "Zero waits indefinitely.",
+                            &http_request_timeout,
+                            0,
+                            0,
+                            INT_MAX,
+                            PGC_USERSET,
+                            GUC_UNIT_MS,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomIntVariable("gsheets.stall_timeout",
+                            "Time after which a request that receives no data is aborted",
+                            "Applies even when gsheets.request_timeout is zero.",
+                            &http_stall_timeout,
+                            60,
+                            1,
+                            INT_MAX,
+                            PGC_USERSET,
+                            GUC_UNIT_S,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomIntVariable("gsheets.hedge_percentile",
+                            "Percentile of recent time-to-first-byte after which a read request is duplicated",
+                            "Zero disables hedged requests.",
+                            &http_hedge_percentile,
+                            0,
+                            0,
+                            100,
+                            PGC_USERSET,
+                            0,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomIntVariable("gsheets.hedge_min_delay",
+                            "Minimum delay before a read request is duplicated",
+                            NULL,
+                            &http_hedge_min_delay,
+                            50,
+                            0,
+                            INT_MAX,
+                            PGC_USERSET,
+                            GUC_UNIT_MS,
+                            NULL,
+                            NULL,
+                            NULL);
+    DefineCustomBoolVariable("gsheets.http_gateway",
+                             "Send HTTP requests through a shared background worker",
+                             "Only takes effect when gsheets is in shared_preload_libraries.",
+                             &http_gateway_enabled,
+                             false,
+                             PGC_POSTMASTER,
+                             0,
+                             NULL,
+                             NULL,
+                             NULL);
     MarkGUCPrefixReserved("gsheets");
     http_init();
+
+    if (process_shared_preload_libraries_in_progress && http_gateway_enabled)
+        http_gateway_register();
 }
 
 void _PG_fini(void);
@@ -111,63 +286,683 @@ static char *extract_id(const char *url)
     return id;
 }
 
-static List *infer_types(const char *id, const char *sheet, bool has_header)
+/*
+ * Merge a newly observed cell type into the type inferred so far for a
+ * column.  Integers widen to numeric and dates to timestamps, any other
+ * conflict widens to text.
+ */
+Oid widen_type(Oid current, Oid next)
+{
+    if (current == InvalidOid)
+        return next;
+    if (next == InvalidOid || current == next)
+        return current;
+    if ((current == INT8OID && next == NUMERICOID) ||
+        (current == NUMERICOID && next == INT8OID))
+        return NUMERICOID;
+    if ((current == DATEOID && next == TIMESTAMPOID) ||
+        (current == TIMESTAMPOID && next == DATEOID))
+        return TIMESTAMPOID;
+    return TEXTOID;
+}
+
+/* Whether a number format type is the given one */
+static bool format_is(JsonbValue *type, const char *name)
+{
+    return type->val.string.len == strlen(name) &&
+        strncmp(type->val.string.val, name, type->val.string.len) == 0;
+}
+
+/* Type of a single CellData object, or InvalidOid if the cell is empty */
+Oid cell_type(JsonbValue *cell)
+{
+    JsonbValue *value;
+    JsonbValue *v;
+
+    if (cell == NULL || cell->type != jbvBinary)
+        return InvalidOid;
+
+    value = getKeyJsonValueFromContainer(cell->val.binary.data, "effectiveValue", 14, NULL);
+    if (value == NULL || value->type != jbvBinary)
+        return InvalidOid;
+
+    if ((v = getKeyJsonValueFromContainer(value->val.binary.data, "numberValue", 11, NULL)) != NULL)
+    {
+        JsonbValue *format;
+        char *num;
+
+        format = getKeyJsonValueFromContainer(cell->val.binary.data, "userEnteredFormat", 17, NULL);
+        if (format != NULL && format->type == jbvBinary)
+        {
+            JsonbValue *number_format;
+            JsonbValue *type;
+
+            number_format = getKeyJsonValueFromContainer(format->val.binary.data, "numberFormat", 12, NULL);
+            if (number_format != NULL && number_format->type == jbvBinary)
+            {
+                type = getKeyJsonValueFromContainer(number_format->val.binary.data, "type", 4, NULL);
+                if (type != NULL && type->type == jbvString)
+                {
+                    if (format_is(type, "DATE"))
+                        return DATEOID;
+                    if (format_is(type, "DATE_TIME"))
+                        return TIMESTAMPOID;
+                    if (format_is(type, "TIME"))
+                        return TIMEOID;
+                }
+            }
+        }
+
+        if (v->type != jbvNumeric)
+            return TEXTOID;
+
+        num = DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(v->val.numeric)));
+        if (strpbrk(num, ".eE") != NULL || strlen(num) > 18)
+            return NUMERICOID;
+        return INT8OID;
+    }
+    else if (getKeyJsonValueFromContainer(value->val.binary.data, "boolValue", 9, NULL) != NULL)
+        return BOOLOID;
+    else if (getKeyJsonValueFromContainer(value->val.binary.data, "stringValue", 11, NULL) != NULL)
+        return TEXTOID;
+
+    return InvalidOid;
+}
+
+/*
+ * Infer the type of each of the 'ncols' columns of a sheet by sampling
+ * gsheets.infer_sample_rows rows from sheet row 'first_row', the first data
+ * row being read.
+ */
+static List *infer_types(const char *id, const char *sheet, int first_row, int ncols,
+                         struct curl_slist *headers)
 {
     char *response;
     Jsonb *jsonb;
-    JsonbValue v;
-    JsonbIterator *it;
-    JsonbIteratorToken r;
-    Jsonb *values;
-    Datum *elems;
+    Jsonb *rows;
+    Datum elems[5];
     bool is_null = false;
     char *params[] = {
-        psprintf("ranges=%s!A%d:Z", sheet, has_header ? 2 : 1),
+        psprintf("ranges=%s!A%d:Z%d", sheet, first_row, first_row + infer_sample_rows - 1),
         "fields=" TYPEINFER_FIELDS
     };
+    Oid *col_types = (Oid *) palloc0(ncols * sizeof(Oid));
     List *types = NIL;
 
-    response = http_get(METADATA_URL(id), params, 3, NULL);
-    jsonb = DatumGetJsonbP(DirectFunctionCall1(jsonb_in, CStringGetDatum(response)));
+    response = http_get(METADATA_URL(id), params, 2, headers);
+    jsonb = parse_json(response);
+    free(response);
 
-    elems = (Datum *)palloc(7 * sizeof(Datum));
     elems[0] = CStringGetTextDatum("sheets");
     elems[1] = CStringGetTextDatum("0");
     elems[2] = CStringGetTextDatum("data");
     elems[3] = CStringGetTextDatum("0");
     elems[4] = CStringGetTextDatum("rowData");
-    elems[5] = CStringGetTextDatum("0");
-    elems[6] = CStringGetTextDatum("values");
-    values = DatumGetJsonbP(jsonb_get_element(jsonb, elems, 7, &is_null, false));
+    rows = DatumGetJsonbP(jsonb_get_element(jsonb, elems, 5, &is_null, false));
 
-    it = JsonbIteratorInit(&values->root);
-    while ((r = JsonbIteratorNext(&it, &v, false)) != WJB_DONE)
+    if (!is_null && JB_ROOT_IS_ARRAY(rows))
     {
-        if (r == WJB_KEY)
+        int nrows = JsonContainerSize(&rows->root);
+
+        for (int r = 0; r < nrows; r++)
         {
-            char *key = pnstrdup(v.val.string.val, v.val.string.len);
-            if (strcmp(key, "numberValue") == 0)
-                types = lappend_oid(types, INT8OID);
-            else if (strcmp(key, "boolValue") == 0)
-                types = lappend_oid(types, BOOLOID);
-            else if (strcmp(key, "stringValue") == 0)
-                types = lappend_oid(types, TEXTOID);
+            JsonbValue *row = getIthJsonbValueFromContainer(&rows->root, r);
+            JsonbValue *cells;
+
+            if (row == NULL || row->type != jbvBinary)
+                continue;
+
+            cells = getKeyJsonValueFromContainer(row->val.binary.data, "values", 6, NULL);
+            if (cells == NULL || cells->type != jbvBinary)
+                continue;
+
+            for (int c = 0; c < ncols && c < JsonContainerSize(cells->val.binary.data); c++)
+                col_types[c] = widen_type(col_types[c],
+                                          cell_type(getIthJsonbValueFromContainer(cells->val.binary.data, c)));
         }
-        else if (r == WJB_VALUE)
+    }
+
+    /* Columns without any sampled value are read as text */
+    for (int c = 0; c < ncols; c++)
+        types = lappend_oid(types, col_types[c] == InvalidOid ? TEXTOID : col_types[c]);
+
+    pfree(col_types);
+    return types;
+}
+
+/* Quoted schema of the extension's objects, must be called within SPI */
+static char *extension_schema(void)
+{
+    if (SPI_execute("SELECT pg_catalog.quote_ident(n.nspname) FROM pg_catalog.pg_extension e "
+                    "JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace "
+                    "WHERE e.extname = 'gsheets'", true, 1) != SPI_OK_SELECT ||
+        SPI_processed != 1)
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_OBJECT),
+                 errmsg("extension \"gsheets\" is not installed")));
+
+    return SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1);
+}
+
+/*
+ * Types inference can produce.  Anything else found in the schema cache is
+ * not trusted, read_sheet could not build its values.
+ */
+static bool inferable_type(Oid typid)
+{
+    switch (typid)
+    {
+        case INT8OID:
+        case NUMERICOID:
+        case BOOLOID:
+        case DATEOID:
+        case TIMESTAMPOID:
+        case TIMEOID:
+        case TEXTOID:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Identify the shape of a sheet without a metadata request: the column count
+ * and, when the sheet has one, a hash of the header row.
+ */
+char *schema_revision(List *names, int ncols)
+{
+    StringInfoData buf;
+    ListCell *lc;
+    uint32 hash;
+
+    initStringInfo(&buf);
+    foreach(lc, names)
+    {
+        appendStringInfoString(&buf, (char *) lfirst(lc));
+        appendStringInfoChar(&buf, '\x1f');
+    }
+    hash = hash_bytes((unsigned char *) buf.data, buf.len);
+    pfree(buf.data);
+
+    return psprintf("%d:%08x", ncols, hash);
+}
+
+/* Column types stored for the given sheet revision, or NIL if unknown */
+static List *lookup_schema(const char *id, const char *sheet, const char *revision)
+{
+    MemoryContext caller = CurrentMemoryContext;
+    Oid argtypes[3] = {TEXTOID, TEXTOID, TEXTOID};
+    Datum args[3];
+    List *types = NIL;
+
+    if (!enable_schema_cache)
+        return NIL;
+
+    args[0] = CStringGetTextDatum(id);
+    args[1] = CStringGetTextDatum(sheet);
+    args[2] = CStringGetTextDatum(revision);
+
+    SPI_connect();
+    if (SPI_execute_with_args(psprintf("SELECT %s.gsheets_lookup_schema($1, $2, $3)",
+                                       extension_schema()),
+                              3, argtypes, args, NULL, true, 1) == SPI_OK_SELECT &&
+        SPI_processed == 1)
+    {
+        bool isnull;
+        Datum d = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+
+        if (!isnull)
         {
-            char *val = pnstrdup(v.val.string.val, v.val.string.len);
-            if (strcmp(val, "DATE") == 0)
+            Datum *elems;
+            int nelems;
+
+            deconstruct_array(DatumGetArrayTypeP(d), REGTYPEOID, sizeof(Oid), true,
+                              TYPALIGN_INT, &elems, NULL, &nelems);
+
+            MemoryContextSwitchTo(caller);
+            for (int i = 0; i < nelems; i++)
             {
-                // remove the last element
-                types = list_truncate(types, list_length(types) - 1);
-                types = lappend_oid(types, DATEOID);
+                if (!inferable_type(DatumGetObjectId(elems[i])))
+                {
+                    list_free(types);
+                    types = NIL;
+                    break;
+                }
+                types = lappend_oid(types, DatumGetObjectId(elems[i]));
             }
         }
     }
+    SPI_finish();
 
     return types;
 }
 
+/* Remember the inferred schema of a sheet, replacing older revisions */
+void store_schema(const char *id, const char *sheet, const char *revision,
+                  List *names, List *types)
+{
+    Oid argtypes[5] = {TEXTOID, TEXTOID, TEXTOID, TEXTARRAYOID, REGTYPEARRAYOID};
+    Datum args[5];
+    char nulls[5] = {' ', ' ', ' ', ' ', ' '};
+    Datum *elems;
+    ListCell *lc;
+    int i;
+
+    if (!enable_schema_cache || RecoveryInProgress() || XactReadOnly)
+        return;
+
+    args[0] = CStringGetTextDatum(id);
+    args[1] = CStringGetTextDatum(sheet);
+    args[2] = CStringGetTextDatum(revision);
+
+    if (names == NIL)
+    {
+        args[3] = (Datum) 0;
+        nulls[3] = 'n';
+    }
+    else
+    {
+        elems = (Datum *) palloc(list_length(names) * sizeof(Datum));
+        i = 0;
+        foreach(lc, names)
+            elems[i++] = CStringGetTextDatum((char *) lfirst(lc));
+        args[3] = PointerGetDatum(construct_array(elems, i, TEXTOID, -1, false, TYPALIGN_INT));
+    }
+
+    elems = (Datum *) palloc(list_length(types) * sizeof(Datum));
+    i = 0;
+    foreach(lc, types)
+        elems[i++] = ObjectIdGetDatum(lfirst_oid(lc));
+    args[4] = PointerGetDatum(construct_array(elems, i, REGTYPEOID, sizeof(Oid), true, TYPALIGN_INT));
+
+    /* The cache is owned by the extension, only its function writes to it */
+    SPI_connect();
+    if (SPI_execute_with_args(psprintf("SELECT %s.gsheets_store_schema($1, $2, $3, $4, $5)",
+                                       extension_schema()),
+                              5, argtypes, args, nulls, false, 0) != SPI_OK_SELECT)
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("could not store inferred schema of sheet \"%s\"", sheet)));
+    SPI_finish();
+}
+
+/*
+ * Text of an unformatted cell value.  Numbers are printed in full and
+ * booleans as Google shows them, as they are in a formatted header.
+ */
+static char *cell_text(JsonbValue *cell)
+{
+    if (cell == NULL)
+        return pstrdup("");
+
+    switch (cell->type)
+    {
+        case jbvString:
+            return pnstrdup(cell->val.string.val, cell->val.string.len);
+        case jbvNumeric:
+            return DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(cell->val.numeric)));
+        case jbvBool:
+            return pstrdup(cell->val.boolean ? "TRUE" : "FALSE");
+        default:
+            return pstrdup("");
+    }
+}
+
+/* The rows of a values response, or NULL if the range is empty */
+static JsonbValue *sheet_rows(Jsonb *jsonb)
+{
+    JsonbValue *rows;
+
+    if (!JB_ROOT_IS_OBJECT(jsonb))
+        return NULL;
+
+    rows = getKeyJsonValueFromContainer(&jsonb->root, "values", 6, NULL);
+    if (rows == NULL || rows->type != jbvBinary || !JsonContainerIsArray(rows->val.binary.data))
+        return NULL;
+
+    return rows;
+}
+
+/* Cell 'c' of row 'r' of a values response, or NULL past the end of either */
+JsonbValue *sheet_cell(JsonbValue *rows, int r, int c)
+{
+    JsonbValue *row;
+
+    if (r >= JsonContainerSize(rows->val.binary.data))
+        return NULL;
+
+    row = getIthJsonbValueFromContainer(rows->val.binary.data, r);
+    if (row == NULL || row->type != jbvBinary || c >= JsonContainerSize(row->val.binary.data))
+        return NULL;
+
+    return getIthJsonbValueFromContainer(row->val.binary.data, c);
+}
+
+/* Type of an unformatted cell's value, or InvalidOid if the cell is empty */
+static Oid value_type(JsonbValue *cell)
+{
+    char *num;
+
+    if (cell == NULL || cell->type == jbvNull ||
+        (cell->type == jbvString && cell->val.string.len == 0))
+        return InvalidOid;
+
+    switch (cell->type)
+    {
+        case jbvBool:
+            return BOOLOID;
+        case jbvNumeric:
+            num = DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(cell->val.numeric)));
+            if (strpbrk(num, ".eE") != NULL || strlen(num) > 18)
+                return NUMERICOID;
+            return INT8OID;
+        default:
+            return TEXTOID;
+    }
+}
+
+/* Whether an unformatted cell can be read as the given type */
+static bool value_fits(Oid value, Oid typid)
+{
+    switch (typid)
+    {
+        case TEXTOID:
+            return true;
+        case NUMERICOID:
+        case DATEOID:
+        case TIMESTAMPOID:
+        case TIMEOID:
+            /* Dates and times are serial numbers */
+            return value == InvalidOid || value == INT8OID || value == NUMERICOID;
+        default:
+            return value == InvalidOid || value == typid;
+    }
+}
+
+/*
+ * Widen 'types' until every value of the data rows fits.  'changed' tells
+ * whether any type had to be widened.
+ */
+static List *fit_types(JsonbValue *rows, int first_row, List *types, bool *changed)
+{
+    int nrows = JsonContainerSize(rows->val.binary.data);
+    List *fitted = NIL;
+
+    *changed = false;
+    for (int c = 0; c < list_length(types); c++)
+    {
+        Oid typid = list_nth_oid(types, c);
+
+        for (int r = first_row; r < nrows && typid != TEXTOID; r++)
+        {
+            Oid value = value_type(sheet_cell(rows, r, c));
+
+            if (!value_fits(value, typid))
+            {
+                typid = widen_type(typid, value);
+                *changed = true;
+            }
+        }
+        fitted = lappend_oid(fitted, typid);
+    }
+
+    return fitted;
+}
+
+/*
+ * Column types of a sheet whose values have already been fetched into
+ * 'rows', starting at sheet row 'start_row' with the header first if
+ * 'has_header'.  Inference samples the rows below it.  The stored schema is reused when the sheet's shape has not
+ * changed and its values still fit the stored types, otherwise the types
+ * are inferred, widened to fit every value, and stored.
+ */
+static List *sheet_types(const char *id, const char *sheet, bool has_header, int start_row,
+                         JsonbValue *rows, struct curl_slist *headers)
+{
+    JsonbValue *first;
+    List *names = NIL;
+    List *types;
+    char *revision;
+    int ncols;
+    bool changed;
+
+    first = getIthJsonbValueFromContainer(rows->val.binary.data, 0);
+    if (first == NULL || first->type != jbvBinary)
+        return NIL;
+
+    ncols = JsonContainerSize(first->val.binary.data);
+    if (has_header)
+    {
+        for (int i = 0; i < ncols; i++)
+            names = lappend(names, cell_text(getIthJsonbValueFromContainer(first->val.binary.data, i)));
+    }
+
+    revision = schema_revision(names, ncols);
+    types = lookup_schema(id, sheet, revision);
+    if (list_length(types) == ncols)
+    {
+        /* Values of another type mean the data changed under the same header */
+        fit_types(rows, has_header ? 1 : 0, types, &changed);
+        if (!changed)
+            return types;
+    }
+
+    /* The sample may miss values further down, which must still convert */
+    types = infer_types(id, sheet, start_row + (has_header ? 1 : 0), ncols, headers);
+    types = fit_types(rows, has_header ? 1 : 0, types, &changed);
+    store_schema(id, sheet, revision, names, types);
+
+    return types;
+}
+
+/*
+ * Formatted cells of the text columns that hold numbers or booleans, which
+ * show as they do in the sheet, by column and NULL for the other columns.
+ * Only those columns are read again, from 'start_row' like 'rows'.  NULL if
+ * there are none.
+ */
+static JsonbValue **formatted_columns(const char *id, const char *sheet, int start_row,
+                                      JsonbValue *rows, int first_row, List *types,
+                                      struct curl_slist *headers)
+{
+    int ncols = list_length(types);
+    int nrows = JsonContainerSize(rows->val.binary.data);
+    char **params = (char **) palloc(ncols * sizeof(char *));
+    int *cols = (int *) palloc(ncols * sizeof(int));
+    int nparams = 0;
+    JsonbValue **formatted;
+    JsonbValue *ranges;
+    Jsonb *jsonb;
+
+    for (int c = 0; c < ncols; c++)
+    {
+        if (list_nth_oid(types, c) != TEXTOID)
+            continue;
+
+        for (int r = first_row; r < nrows; r++)
+        {
+            JsonbValue *cell = sheet_cell(rows, r, c);
+
+            if (cell != NULL && (cell->type == jbvNumeric || cell->type == jbvBool))
+            {
+                char *letter = column_letter(c);
+
+                params[nparams] = psprintf("ranges=%s",
+                                           url_encode(psprintf("%s!%s%d:%s", quote_sheet_name(sheet),
+                                                               letter, start_row, letter)));
+                cols[nparams++] = c;
+                break;
+            }
+        }
+    }
+
+    if (nparams == 0)
+        return NULL;
+
+    jsonb = api_response(http_get(BATCH_URL(id), params, nparams, headers), id);
+
+    formatted = (JsonbValue **) palloc0(ncols * sizeof(JsonbValue *));
+    if (JB_ROOT_IS_OBJECT(jsonb) &&
+        (ranges = getKeyJsonValueFromContainer(&jsonb->root, "valueRanges", 11, NULL)) != NULL &&
+        ranges->type == jbvBinary)
+    {
+        for (int i = 0; i < nparams && i < JsonContainerSize(ranges->val.binary.data); i++)
+        {
+            JsonbValue *range = getIthJsonbValueFromContainer(ranges->val.binary.data, i);
+            JsonbValue *values;
+
+            if (range == NULL || range->type != jbvBinary)
+                continue;
+            values = getKeyJsonValueFromContainer(range->val.binary.data, "values", 6, NULL);
+            if (values != NULL && values->type == jbvBinary && JsonContainerIsArray(values->val.binary.data))
+                formatted[cols[i]] = values;
+        }
+    }
+
+    return formatted;
+}
+
+/*
+ * Date, timestamp or time of a spreadsheet serial number, the days since
+ * 1899-12-30 with the time of day as the fraction.
+ */
+static Datum serial_datum(double serial, Oid typid)
+{
+    double days = floor(serial);
+    int64 usecs = (int64) rint((serial - days) * USECS_PER_DAY);
+
+    if (typid == TIMEOID)
+        return TimeADTGetDatum(usecs % USECS_PER_DAY);
+
+    days -= SERIAL_EPOCH_OFFSET;
+    if (typid == DATEOID)
+    {
+        if (!IS_VALID_DATE(days))
+            ereport(ERROR,
+                    (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+                     errmsg("date out of range: %g", serial)));
+        return DateADTGetDatum((DateADT) days);
+    }
+
+    if (days < DATETIME_MIN_JULIAN - POSTGRES_EPOCH_JDATE ||
+        days >= TIMESTAMP_END_JULIAN - POSTGRES_EPOCH_JDATE ||
+        !IS_VALID_TIMESTAMP((int64) days * USECS_PER_DAY + usecs))
+        ereport(ERROR,
+                (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+                 errmsg("timestamp out of range: %g", serial)));
+    return TimestampGetDatum((int64) days * USECS_PER_DAY + usecs);
+}
+
+/*
+ * Convert a cell of a values response to a datum of the given type.  Cells
+ * of inferred columns are unformatted: numbers are JSON numbers, dates and
+ * times serial numbers, and booleans JSON booleans.  Formatted cells are
+ * strings and are parsed by the type's input function.  Empty cells are
+ * NULL unless the column is text.
+ */
+static Datum cell_datum(JsonbValue *cell, Oid typid, bool *isnull)
+{
+    char *val;
+
+    *isnull = false;
+
+    if (cell == NULL || cell->type == jbvNull ||
+        (cell->type == jbvString && cell->val.string.len == 0))
+    {
+        if (typid == TEXTOID)
+            return CStringGetTextDatum("");
+        *isnull = true;
+        return (Datum) 0;
+    }
+
+    if (cell->type == jbvNumeric)
+    {
+        switch (typid)
+        {
+            case INT8OID:
+                return DirectFunctionCall1(numeric_int8, NumericGetDatum(cell->val.numeric));
+            case NUMERICOID:
+                return NumericGetDatum(cell->val.numeric);
+            case DATEOID:
+            case TIMESTAMPOID:
+            case TIMEOID:
+                return serial_datum(DatumGetFloat8(DirectFunctionCall1(numeric_float8,
+                                                                       NumericGetDatum(cell->val.numeric))),
+                                    typid);
+            default:
+                break;
+        }
+    }
+    else if (cell->type == jbvBool && typid == BOOLOID)
+        return BoolGetDatum(cell->val.boolean);
+
+    val = cell_text(cell);
+    switch (typid)
+    {
+        case INT8OID:
+            return DirectFunctionCall1(int8in, CStringGetDatum(val));
+        case NUMERICOID:
+            return DirectFunctionCall3(numeric_in, CStringGetDatum(val),
+                                       ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1));
+        case BOOLOID:
+            return DirectFunctionCall1(boolin, CStringGetDatum(val));
+        case DATEOID:
+            return DirectFunctionCall1(date_in, CStringGetDatum(val));
+        case TIMESTAMPOID:
+            return DirectFunctionCall3(timestamp_in, CStringGetDatum(val),
+                                       ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1));
+        case TIMEOID:
+            return DirectFunctionCall3(time_in, CStringGetDatum(val),
+                                       ObjectIdGetDatum(InvalidOid), Int32GetDatum(-1));
+        default:
+            return CStringGetTextDatum(val);
+    }
+}
+
+/*
+ * Convert an unformatted cell to a value of any type.  Serial numbers of
+ * date and time columns are converted directly, anything else is the cell's
+ * text through the type's input function.  Empty cells are NULL unless
+ * 'keep_empty', which gives the type's value of ''.
+ */
+Datum value_datum(JsonbValue *cell, Oid typid, FmgrInfo *in_func, Oid typioparam, int32 typmod,
+                  bool keep_empty, bool *isnull)
+{
+    *isnull = false;
+
+    if (cell == NULL || cell->type == jbvNull ||
+        (cell->type == jbvString && cell->val.string.len == 0))
+    {
+        if (keep_empty)
+            return InputFunctionCall(in_func, "", typioparam, typmod);
+        *isnull = true;
+        return (Datum) 0;
+    }
+
+    if (cell->type == jbvNumeric &&
+        (typid == DATEOID || typid == TIMESTAMPOID || typid == TIMESTAMPTZOID || typid == TIMEOID))
+    {
+        double serial = DatumGetFloat8(DirectFunctionCall1(numeric_float8,
+                                                           NumericGetDatum(cell->val.numeric)));
+
+        if (typid == TIMESTAMPTZOID)
+            return DirectFunctionCall1(timestamp_timestamptz, serial_datum(serial, TIMESTAMPOID));
+        return serial_datum(serial, typid);
+    }
+
+    return InputFunctionCall(in_func, cell_text(cell), typioparam, typmod);
+}
+
+/* The unformatted rows of a range, or NULL if it is empty */
+JsonbValue *fetch_values(const char *id, const char *range, struct curl_slist *headers)
+{
+    char *params[] = {
+        "valueRenderOption=UNFORMATTED_VALUE",
+        "dateTimeRenderOption=SERIAL_NUMBER"
+    };
+    return sheet_rows(api_response(http_get(SHEET_URL(id, range), params, 2, headers), id));
+}
+
 static bool validate_url(const char *url)
 {
     if (strstr(url, "https://docs.google.com/spreadsheets/") == NULL)
@@ -175,6 +970,114 @@ static bool validate_url(const char *url)
     return true;
 }
 
+/* Spreadsheet id from either a spreadsheet URL or a bare id */
+char *sheet_id_from_link(const char *link)
+{
+    if (validate_url(link))
+        return extract_id(link);
+    else if (strlen(link) == 44)
+        return pstrdup(link);
+
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("Invalid URL or sheet id")));
+    return NULL;                /* keep compiler quiet */
+}
+
+/* Request headers carrying the access token, which must be set */
+struct curl_slist *auth_headers(void)
+{
+    if (access_token == NULL || strlen(access_token) == 0)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("Access token is required"),
+                 errhint("Set gsheets.access_token")));
+
+    return add_header(NULL, "Authorization", psprintf("Bearer %s", access_token));
+}
+
+/* Parse a JSON response, reported as the GSheetsParse wait event */
+Jsonb *parse_json(const char *response)
+{
+    size_t len = strlen(response);
+    Jsonb *jsonb;
+
+    TRACE_GSHEETS_PARSE_START(len);
+    pgstat_report_wait_start(gsheets_wait_event(WAIT_PARSE));
+    jsonb = DatumGetJsonbP(DirectFunctionCall1(jsonb_in, CStringGetDatum(response)));
+    pgstat_report_wait_end();
+    TRACE_GSHEETS_PARSE_DONE(len);
+
+    return jsonb;
+}
+
+/*
+ * Parse a response of the Sheets API, which is freed.  Requests rejected by
+ * Google are reported as errors.
+ */
+Jsonb *api_response(char *response, const char *id)
+{
+    Jsonb *jsonb = parse_json(response);
+    JsonbValue *error;
+
+    free(response);
+
+    if (JB_ROOT_IS_OBJECT(jsonb) &&
+        (error = getKeyJsonValueFromContainer(&jsonb->root, "error", 5, NULL)) != NULL &&
+        error->type == jbvBinary)
+    {
+        JsonbValue *message = getKeyJsonValueFromContainer(error->val.binary.data, "message", 7, NULL);
+
+        ereport(ERROR,
+                (errcode(ERRCODE_CONNECTION_FAILURE),
+                 errmsg("Request to spreadsheet \"%s\" failed", id),
+                 message && message->type == jbvString ?
+                 errdetail("%.*s", message->val.string.len, message->val.string.val) : 0));
+    }
+
+    return jsonb;
+}
+
+/* Spreadsheet metadata selected by 'params' */
+Jsonb *fetch_metadata(const char *id, char **params, int nparams, struct curl_slist *headers)
+{
+    return api_response(http_get(METADATA_URL(id), params, nparams, headers), id);
+}
+
+/* Letter of the n-th (zero based) sheet column: A, B, ..., Z, AA, AB, ... */
+char *column_letter(int n)
+{
+    char buf[8];
+    int pos = sizeof(buf) - 1;
+
+    buf[pos] = '\0';
+    do
+    {
+        buf[--pos] = 'A' + n % 26;
+        n = n / 26 - 1;
+    } while (n >= 0 && pos > 0);
+
+    return pstrdup(&buf[pos]);
+}
+
+/* Sheet name quoted for use in an A1 range, as in 'Q1 ''24'!A1 */
+char *quote_sheet_name(const char *title)
+{
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendStringInfoChar(&buf, '\'');
+    for (const char *c = title; *c; c++)
+    {
+        if (*c == '\'')
+            appendStringInfoChar(&buf, '\'');
+        appendStringInfoChar(&buf, *c);
+    }
+    appendStringInfoChar(&buf, '\'');
+
+    return buf.data;
+}
+
 static void remove_trailing_comma(StringInfoData *buff)
 {
     int len = buff->len;
@@ -186,38 +1089,517 @@ static void remove_trailing_comma(StringInfoData *buff)
     }
 }
 
-static void initialize_buffer(StringInfoData *buff)
+static int json_int(JsonbContainer *container, const char *key, int missing)
+{
+    JsonbValue *v = getKeyJsonValueFromContainer(container, key, strlen(key), NULL);
+
+    if (v == NULL || v->type != jbvNumeric)
+        return missing;
+    return DatumGetInt32(DirectFunctionCall1(numeric_int4, NumericGetDatum(v->val.numeric)));
+}
+
+/* Title, id and grid size from the "properties" of a sheet */
+static sheet_tab *tab_properties(JsonbValue *props)
+{
+    sheet_tab *tab = (sheet_tab *) palloc0(sizeof(sheet_tab));
+    JsonbValue *title;
+    JsonbValue *grid;
+
+    if (props == NULL || props->type != jbvBinary)
+        return tab;
+
+    title = getKeyJsonValueFromContainer(props->val.binary.data, "title", 5, NULL);
+    if (title != NULL && title->type == jbvString)
+        tab->title = pnstrdup(title->val.string.val, title->val.string.len);
+
+    /* The first sheet's id is zero, which the API may leave out */
+    tab->sheet_id = json_int(props->val.binary.data, "sheetId", 0);
+
+    grid = getKeyJsonValueFromContainer(props->val.binary.data, "gridProperties", 14, NULL);
+    if (grid != NULL && grid->type == jbvBinary)
+    {
+        tab->nrows = json_int(grid->val.binary.data, "rowCount", 0);
+        tab->ncols = json_int(grid->val.binary.data, "columnCount", 0);
+    }
+
+    return tab;
+}
+
+/* The tabs of a spreadsheet, as sheet_tabs */
+List *sheet_tabs(const char *id, struct curl_slist *headers)
 {
-    initStringInfo(buff);
-    appendStringInfoChar(buff, '{');
-    appendStringInfoString(buff, "\"values\": [");
+    char *params[] = {"fields=" TAB_FIELDS};
+    Jsonb *jsonb = fetch_metadata(id, params, 1, headers);
+    JsonbValue *sheets;
+    List *tabs = NIL;
+
+    if (!JB_ROOT_IS_OBJECT(jsonb) ||
+        (sheets = getKeyJsonValueFromContainer(&jsonb->root, "sheets", 6, NULL)) == NULL ||
+        sheets->type != jbvBinary)
+        return NIL;
+
+    for (int i = 0; i < JsonContainerSize(sheets->val.binary.data); i++)
+    {
+        JsonbValue *sheet = getIthJsonbValueFromContainer(sheets->val.binary.data, i);
+        sheet_tab *tab;
+
+        if (sheet == NULL || sheet->type != jbvBinary)
+            continue;
+
+        tab = tab_properties(getKeyJsonValueFromContainer(sheet->val.binary.data, "properties", 10, NULL));
+        if (tab->title != NULL)
+            tabs = lappend(tabs, tab);
+    }
+
+    return tabs;
 }
 
-static void close_buffer(StringInfoData *buff)
+/* Rows of the tab named 'sheet_name', set up when its first row arrives */
+static write_target *get_target(write_state *state, const char *sheet_name)
 {
-    remove_trailing_comma(buff);
-    appendStringInfoChar(buff, ']');
-    appendStringInfoChar(buff, '}');
+    MemoryContext old_mcxt;
+    write_target *target;
+    ListCell *lc;
+
+    foreach(lc, state->targets)
+    {
+        target = (write_target *) lfirst(lc);
+        if (strcmp(target->sheet_name, sheet_name) == 0)
+            return target;
+    }
+
+    old_mcxt = MemoryContextSwitchTo(state->state_mcxt);
+
+    target = (write_target *) palloc0(sizeof(write_target));
+    target->sheet_name = pstrdup(sheet_name);
+    initStringInfo(&target->rows);
+    target->exists = (state->partition_by == NULL && !state->typed);
+    foreach(lc, state->existing_tabs)
+    {
+        sheet_tab *tab = (sheet_tab *) lfirst(lc);
+
+        if (strcmp(tab->title, sheet_name) == 0)
+        {
+            target->exists = true;
+            target->sheet_id = tab->sheet_id;
+            target->grid_rows = tab->nrows;
+            target->grid_cols = tab->ncols;
+        }
+    }
+    state->targets = lappend(state->targets, target);
+
+    // Every tab starts with the header if there is one
+    if (state->header != NULL)
+    {
+        appendStringInfoString(&target->rows, state->header);
+        appendStringInfoChar(&target->rows, ',');
+        target->width = state->header_width;
+        target->count++;
+        state->pending++;
+        state->tcount++;
+    }
+
+    MemoryContextSwitchTo(old_mcxt);
+    return target;
+}
+
+/* Create the tabs that partitioned rows go to and that do not exist yet */
+static void add_missing_tabs(write_state *state)
+{
+    ListCell *lc;
+    List *added = NIL;
+    Jsonb *jsonb;
+    JsonbValue *replies;
+
+    resetStringInfo(&state->buff);
+    appendStringInfoString(&state->buff, "{\"requests\": [");
+    foreach(lc, state->targets)
+    {
+        write_target *target = (write_target *) lfirst(lc);
+
+        if (target->exists || target->count == 0)
+            continue;
+
+        if (added != NIL)
+            appendStringInfoChar(&state->buff, ',');
+        added = lappend(added, target);
+        appendStringInfoString(&state->buff, "{\"addSheet\": {\"properties\": {\"title\": ");
+        escape_json(&state->buff, target->sheet_name);
+        appendStringInfoString(&state->buff, "}}}");
+        target->exists = true;
+    }
+    appendStringInfoString(&state->buff, "]}");
+
+    if (added == NIL)
+        return;
+
+    resetStringInfo(&state->url);
+    appendStringInfo(&state->url, "%s/%s:batchUpdate", BASE_URL, state->spreadsheet_id);
+    jsonb = api_response(http_post(state->url.data, state->buff.data, NULL, 0, state->headers),
+                         state->spreadsheet_id);
+
+    if (!state->typed)
+        return;
+
+    /* Typed writes need the ids of the new tabs, the replies are in request order */
+    replies = JB_ROOT_IS_OBJECT(jsonb) ?
+        getKeyJsonValueFromContainer(&jsonb->root, "replies", 7, NULL) : NULL;
+    for (int i = 0; i < list_length(added); i++)
+    {
+        write_target *target = (write_target *) list_nth(added, i);
+        JsonbValue *reply = NULL;
+        JsonbValue *add_sheet = NULL;
+        sheet_tab *tab;
+
+        if (replies != NULL && replies->type == jbvBinary)
+            reply = getIthJsonbValueFromContainer(replies->val.binary.data, i);
+        if (reply != NULL && reply->type == jbvBinary)
+            add_sheet = getKeyJsonValueFromContainer(reply->val.binary.data, "addSheet", 8, NULL);
+        if (add_sheet == NULL || add_sheet->type != jbvBinary)
+            ereport(ERROR,
+                    (errcode(ERRCODE_CONNECTION_FAILURE),
+                     errmsg("Unexpected response from spreadsheet \"%s\"", state->spreadsheet_id),
+                     errdetail("No reply for the new sheet \"%s\".", target->sheet_name)));
+
+        tab = tab_properties(getKeyJsonValueFromContainer(add_sheet->val.binary.data, "properties", 10, NULL));
+        target->sheet_id = tab->sheet_id;
+        target->grid_rows = tab->nrows;
+        target->grid_cols = tab->ncols;
+    }
 }
 
+/* Send the current batch of every target as one multi-range update */
 static void write_to_gsheet(write_state *state)
 {
-    int start_range;
-    struct curl_slist *headers = NULL;
-    const char *params[] = {
-        "valueInputOption=USER_ENTERED"
-    };
-    char *response;
+    ListCell *lc;
+    bool first = true;
+
+    resetStringInfo(&state->buff);
+    appendStringInfoString(&state->buff, "{\"valueInputOption\": \"USER_ENTERED\", \"data\": [");
+    foreach(lc, state->targets)
+    {
+        write_target *target = (write_target *) lfirst(lc);
+
+        if (target->count == 0)
+            continue;
+
+        if (!first)
+            appendStringInfoChar(&state->buff, ',');
+        first = false;
+        appendStringInfoString(&state->buff, "{\"range\": ");
+        escape_json(&state->buff, psprintf("%s!A%d", quote_sheet_name(target->sheet_name),
+                                           target->written + 1));
+        appendStringInfoString(&state->buff, ", \"values\": [");
+        remove_trailing_comma(&target->rows);
+        appendBinaryStringInfo(&state->buff, target->rows.data, target->rows.len);
+        appendStringInfoString(&state->buff, "]}");
+    }
+    appendStringInfoString(&state->buff, "]}");
+    TRACE_GSHEETS_WRITE_FLUSH(state->pending, state->buff.len);
+
+    resetStringInfo(&state->url);
+    appendStringInfo(&state->url, "%s/%s/values:batchUpdate", BASE_URL, state->spreadsheet_id);
+    api_response(http_post(state->url.data, state->buff.data, NULL, 0, state->headers),
+                 state->spreadsheet_id);
+}
+
+/*
+ * Send the current batch of every target as typed cells in one batchUpdate,
+ * growing grids first where needed: updateCells, unlike the values API,
+ * does not extend the sheet.
+ */
+static void write_cells(write_state *state)
+{
+    ListCell *lc;
+    bool first = true;
+
+    resetStringInfo(&state->buff);
+    appendStringInfoString(&state->buff, "{\"requests\": [");
+    foreach(lc, state->targets)
+    {
+        write_target *target = (write_target *) lfirst(lc);
+        int nrows = target->written + target->count;
+
+        if (target->count == 0)
+            continue;
+
+        if (!first)
+            appendStringInfoChar(&state->buff, ',');
+        first = false;
+
+        if (nrows > target->grid_rows)
+        {
+            appendStringInfo(&state->buff,
+                             "{\"appendDimension\": {\"sheetId\": %d, \"dimension\": \"ROWS\", \"length\": %d}},",
+                             target->sheet_id, nrows - target->grid_rows);
+            target->grid_rows = nrows;
+        }
+        if (target->width > target->grid_cols)
+        {
+            appendStringInfo(&state->buff,
+                             "{\"appendDimension\": {\"sheetId\": %d, \"dimension\": \"COLUMNS\", \"length\": %d}},",
+                             target->sheet_id, target->width - target->grid_cols);
+            target->grid_cols = target->width;
+        }
+
+        appendStringInfo(&state->buff,
+                         "{\"updateCells\": {\"start\": {\"sheetId\": %d, \"rowIndex\": %d, \"columnIndex\": 0}, "
+                         "\"fields\": \"" CELL_FIELDS "\", \"rows\": [",
+                         target->sheet_id, target->written);
+        remove_trailing_comma(&target->rows);
+        appendBinaryStringInfo(&state->buff, target->rows.data, target->rows.len);
+        appendStringInfoString(&state->buff, "]}}");
+    }
+    appendStringInfoString(&state->buff, "]}");
+    TRACE_GSHEETS_WRITE_FLUSH(state->pending, state->buff.len);
+
+    resetStringInfo(&state->url);
+    appendStringInfo(&state->url, "%s/%s:batchUpdate", BASE_URL, state->spreadsheet_id);
+    api_response(http_post(state->url.data, state->buff.data, NULL, 0, state->headers),
+                 state->spreadsheet_id);
+}
+
+/*
+ * Whether a decimal number survives the trip through a double: at most
+ * DBL_DIG significant digits, and neither too large nor too small.
+ */
+static bool exact_double(const char *str)
+{
+    int digits = 0;
+    int zeros = 0;
+    bool leading = true;
+    double d;
+
+    for (const char *p = str; *p != '\0'; p++)
+    {
+        if (*p < '0' || *p > '9')
+            continue;
+        if (*p == '0' && leading)
+            continue;
+        leading = false;
+        /* Trailing zeros only scale the value */
+        if (*p == '0')
+            zeros++;
+        else
+        {
+            digits += zeros + 1;
+            zeros = 0;
+        }
+    }
+    if (digits > DBL_DIG)
+        return false;
+
+    d = strtod(str, NULL);
+    return isfinite(d) && (d == 0 || fabs(d) >= DBL_MIN);
+}
+
+/*
+ * Append 'value' as a typed cell in compact row data: numbers and booleans
+ * as such, dates and times as serial numbers with a matching number format,
+ * anything else as a string, which Google takes verbatim.  Big integers
+ * and numerics a double cannot hold are strings too.  A serial keeps times
+ * to about a microsecond, the formats show milliseconds.
+ */
+static void typed_cell(StringInfo buf, Oid typid, Datum value, FmgrInfo *out_func)
+{
+    const char *format = NULL;
+    double serial = 0;
+    char *str;
+
+    switch (typid)
+    {
+        case BOOLOID:
+            appendStringInfo(buf, "{\"userEnteredValue\":{\"boolValue\":%s}}",
+                             DatumGetBool(value) ? "true" : "false");
+            return;
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case FLOAT4OID:
+        case FLOAT8OID:
+        case NUMERICOID:
+            str = OutputFunctionCall(out_func, value);
+            /* NaN and Infinity are no JSON numbers, they are sent as strings */
+            if (str[strlen(str) - 1] < '0' || str[strlen(str) - 1] > '9')
+                break;
+            /* Sheets holds doubles, a value that would be rounded stays text */
+            if ((typid == INT8OID || typid == NUMERICOID) && !exact_double(str))
+                break;
+            appendStringInfo(buf, "{\"userEnteredValue\":{\"numberValue\":%s}}", str);
+            return;
+        case DATEOID:
+            if (!DATE_NOT_FINITE(DatumGetDateADT(value)))
+            {
+                serial = DatumGetDateADT(value) + SERIAL_EPOCH_OFFSET;
+                format = "{\"type\":\"DATE\",\"pattern\":\"yyyy-mm-dd\"}";
+            }
+            break;
+        case TIMESTAMPTZOID:
+            /* Sheets have no time zones, store the local time */
+            value = DirectFunctionCall1(timestamptz_timestamp, value);
+            /* FALLTHROUGH */
+        case TIMESTAMPOID:
+            if (!TIMESTAMP_NOT_FINITE(DatumGetTimestamp(value)))
+            {
+                serial = SERIAL_EPOCH_OFFSET + (double) DatumGetTimestamp(value) / USECS_PER_DAY;
+                format = "{\"type\":\"DATE_TIME\",\"pattern\":\"yyyy-mm-dd hh:mm:ss.000\"}";
+            }
+            break;
+        case TIMEOID:
+            serial = (double) DatumGetTimeADT(value) / USECS_PER_DAY;
+            format = "{\"type\":\"TIME\",\"pattern\":\"hh:mm:ss.000\"}";
+            break;
+        default:
+            break;
+    }
+
+    if (format != NULL)
+    {
+        appendStringInfo(buf, "{\"userEnteredValue\":{\"numberValue\":%.17g},"
+                         "\"userEnteredFormat\":{\"numberFormat\":%s}}", serial, format);
+        return;
+    }
+
+    appendStringInfoString(buf, "{\"userEnteredValue\":{\"stringValue\":");
+    escape_json(buf, OutputFunctionCall(out_func, value));
+    appendStringInfoString(buf, "}}");
+}
+
+/* Send the buffered rows of all targets and start new batches in the same buffers */
+static void flush_rows(write_state *state)
+{
+    MemoryContext old_mcxt = MemoryContextSwitchTo(state->row_mcxt);
+    ListCell *lc;
+
+    add_missing_tabs(state);
+    if (state->typed)
+        write_cells(state);
+    else
+        write_to_gsheet(state);
+
+    foreach(lc, state->targets)
+    {
+        write_target *target = (write_target *) lfirst(lc);
+
+        target->written += target->count;
+        target->count = 0;
+        resetStringInfo(&target->rows);
+    }
+    state->pending = 0;
+
+    MemoryContextSwitchTo(old_mcxt);
+    MemoryContextReset(state->row_mcxt);
+}
+
+static void free_write_headers(void *arg)
+{
+    write_state *state = (write_state *) arg;
+
+    curl_slist_free_all(state->headers);
+    state->headers = NULL;
+}
+
+static void track_write_memory(write_state *state)
+{
+    write_mem_current = MemoryContextMemAllocated(state->state_mcxt, true);
+    if (write_mem_current > write_mem_peak)
+        write_mem_peak = write_mem_current;
+}
+
+/*
+ * Look up the output functions for 'typid' once, rather than for every row.
+ * For composite types there is one per attribute.
+ */
+static void prepare_output(write_state *state, Oid typid, int32 typmod)
+{
+    MemoryContext old_mcxt;
+    Oid typoutput;
+    bool typIsVarlena;
+
+    if (state->out_funcs != NULL && state->out_type == typid && state->out_typmod == typmod)
+        return;
+
+    old_mcxt = MemoryContextSwitchTo(state->state_mcxt);
+
+    if (state->out_funcs != NULL)
+    {
+        pfree(state->out_funcs);
+        pfree(state->att_types);
+        pfree(state->values);
+        pfree(state->nulls);
+    }
+
+    if (type_is_rowtype(typid))
+    {
+        TupleDesc tupdesc = lookup_rowtype_tupdesc_domain(typid, typmod, false);
+
+        state->natts = tupdesc->natts;
+        state->out_funcs = (FmgrInfo *) palloc0(state->natts * sizeof(FmgrInfo));
+        state->att_types = (Oid *) palloc0(state->natts * sizeof(Oid));
+        for (int i = 0; i < state->natts; i++)
+        {
+            Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+
+            if (att->attisdropped)
+                continue;
+            getTypeOutputInfo(att->atttypid, &typoutput, &typIsVarlena);
+            fmgr_info_cxt(typoutput, &state->out_funcs[i], state->state_mcxt);
+            state->att_types[i] = getBaseType(att->atttypid);
+        }
+        ReleaseTupleDesc(tupdesc);
+    }
+    else
+    {
+        state->natts = 1;
+        state->out_funcs = (FmgrInfo *) palloc0(sizeof(FmgrInfo));
+        state->att_types = (Oid *) palloc(sizeof(Oid));
+        getTypeOutputInfo(typid, &typoutput, &typIsVarlena);
+        fmgr_info_cxt(typoutput, &state->out_funcs[0], state->state_mcxt);
+        state->att_types[0] = getBaseType(typid);
+    }
+
+    state->values = (Datum *) palloc(state->natts * sizeof(Datum));
+    state->nulls = (bool *) palloc(state->natts * sizeof(bool));
+    state->out_type = typid;
+    state->out_typmod = typmod;
+    state->partition_attno = 0;
+
+    MemoryContextSwitchTo(old_mcxt);
+}
+
+/*
+ * Tab the current row of a partitioned write goes to: the value of the
+ * partition_by column, or the default sheet if it is null or empty.
+ */
+static char *row_sheet_name(write_state *state, TupleDesc tupdesc)
+{
+    int i;
+    char *value;
+
+    if (state->partition_by == NULL)
+        return state->sheet_name;
 
-    headers = add_header(headers, "Authorization", psprintf("Bearer %s", access_token));
-    headers = add_header(headers, "Content-Type", "application/json");
+    if (state->partition_attno == 0)
+    {
+        for (i = 0; i < tupdesc->natts; i++)
+        {
+            Form_pg_attribute att = TupleDescAttr(tupdesc, i);
 
-    start_range = state->tcount - state->count + 1;
-    response = http_put(SHEET_URL(state->spreadsheet_id, psprintf("%s!A%d", state->sheet_name, start_range)),
-                        state->buff.data, params, 1, headers);
-    
-    free(headers);
-    free(response);
+            if (!att->attisdropped && strcmp(NameStr(att->attname), state->partition_by) == 0)
+                state->partition_attno = i + 1;
+        }
+        if (state->partition_attno == 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_UNDEFINED_COLUMN),
+                     errmsg("partition_by column \"%s\" does not exist in the row", state->partition_by)));
+    }
+
+    i = state->partition_attno - 1;
+    if (state->nulls[i])
+        return state->sheet_name;
+
+    value = OutputFunctionCall(&state->out_funcs[i], state->values[i]);
+    return value[0] != '\0' ? value : state->sheet_name;
 }
 
 static char *extract_text_from_jsonb(Jsonb *jb, char *field)
@@ -242,17 +1624,21 @@ static char *extract_text_from_jsonb(Jsonb *jb, char *field)
         return NULL;
 }
 
-static void write_header(Jsonb *jb, write_state *state)
+/* The "header" option as a JSON array, or NULL */
+static char *header_row(Jsonb *jb)
 {
-    StringInfoData *buff = &state->buff;
+    StringInfoData header;
+    StringInfoData *buff = &header;
     JsonbValue *v;
     
     if (!JB_ROOT_IS_OBJECT(jb))
-        return;
+        return NULL;
     
     v = getKeyJsonValueFromContainer(&jb->root, "header", 6, NULL);
     if (v == NULL)
-        return;
+        return NULL;
+
+    initStringInfo(&header);
 
     if (v->type == jbvBinary)
         appendStringInfoString(buff, JsonbToCString(NULL, v->val.binary.data, v->val.binary.len));
@@ -266,7 +1652,7 @@ static void write_header(Jsonb *jb, write_state *state)
             switch (elem->type)
             {
                 case jbvString:
-                    appendStringInfo(buff, "\"%s\"", pnstrdup(elem->val.string.val, elem->val.string.len));
+                    escape_json(buff, pnstrdup(elem->val.string.val, elem->val.string.len));
                     break;
                 case jbvNumeric:
                     {
@@ -290,10 +1676,77 @@ static void write_header(Jsonb *jb, write_state *state)
         remove_trailing_comma(buff);
         appendStringInfoChar(buff, ']');
     }
-    appendStringInfoChar(buff, ',');
 
-    state->count++;
-    state->tcount++;
+    return header.data;
+}
+
+/* The "header" option as a typed row, or NULL */
+static char *header_cells(Jsonb *jb, int *width)
+{
+    StringInfoData header;
+    JsonbValue *v;
+
+    *width = 0;
+    if (!JB_ROOT_IS_OBJECT(jb))
+        return NULL;
+
+    v = getKeyJsonValueFromContainer(&jb->root, "header", 6, NULL);
+    if (v == NULL || v->type != jbvBinary || !JsonContainerIsArray(v->val.binary.data))
+        return NULL;
+
+    initStringInfo(&header);
+    appendStringInfoString(&header, "{\"values\":[");
+    for (int i = 0; i < JsonContainerSize(v->val.binary.data); i++)
+    {
+        JsonbValue *elem = getIthJsonbValueFromContainer(v->val.binary.data, i);
+
+        if (i > 0)
+            appendStringInfoChar(&header, ',');
+        (*width)++;
+
+        switch (elem->type)
+        {
+            case jbvString:
+                appendStringInfoString(&header, "{\"userEnteredValue\":{\"stringValue\":");
+                escape_json(&header, pnstrdup(elem->val.string.val, elem->val.string.len));
+                appendStringInfoString(&header, "}}");
+                break;
+            case jbvNumeric:
+                appendStringInfo(&header, "{\"userEnteredValue\":{\"numberValue\":%s}}",
+                                 DatumGetCString(DirectFunctionCall1(numeric_out,
+                                                                     NumericGetDatum(elem->val.numeric))));
+                break;
+            case jbvBool:
+                appendStringInfo(&header, "{\"userEnteredValue\":{\"boolValue\":%s}}",
+                                 elem->val.boolean ? "true" : "false");
+                break;
+            default:
+                appendStringInfoString(&header, "{}");
+                break;
+        }
+    }
+    appendStringInfoString(&header, "]}");
+
+    return header.data;
+}
+
+/* A boolean option, false when not given */
+static bool extract_bool_from_jsonb(Jsonb *jb, char *field)
+{
+    JsonbValue *v;
+
+    if (!JB_ROOT_IS_OBJECT(jb))
+        return false;
+
+    v = getKeyJsonValueFromContainer(&jb->root, field, strlen(field), NULL);
+    if (v == NULL || v->type == jbvNull)
+        return false;
+    if (v->type != jbvBool)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("Option \"%s\" must be a boolean", field)));
+
+    return v->val.boolean;
 }
 
 static void create_new_sheet(char **spreadsheet_id, char *spreadsheet_name)
@@ -324,7 +1777,7 @@ static void create_new_sheet(char **spreadsheet_id, char *spreadsheet_name)
         0, 
         headers
     );
-    jsonb = DatumGetJsonbP(DirectFunctionCall1(jsonb_in, CStringGetDatum(response)));
+    jsonb = parse_json(response);
 
     it = JsonbIteratorInit(&jsonb->root);
     while ((r = JsonbIteratorNext(&it, &v, false)) != WJB_DONE)
@@ -373,6 +1826,179 @@ Datum gsheets_auth(PG_FUNCTION_ARGS)
     PG_RETURN_VOID();
 }
 
+/* Numeric id ("gid") of a sheet, needed by the export endpoint */
+static int sheet_gid(const char *id, const char *sheet, struct curl_slist *headers)
+{
+    char *params[] = {
+        "fields=sheets.properties(sheetId%2Ctitle)"
+    };
+    char *response;
+    Jsonb *jsonb;
+    JsonbValue *sheets;
+
+    response = http_get(METADATA_URL(id), params, 1, headers);
+    jsonb = parse_json(response);
+    free(response);
+
+    if (!JB_ROOT_IS_OBJECT(jsonb) ||
+        (sheets = getKeyJsonValueFromContainer(&jsonb->root, "sheets", 6, NULL)) == NULL ||
+        sheets->type != jbvBinary)
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("Could not read spreadsheet metadata")));
+
+    for (int i = 0; i < JsonContainerSize(sheets->val.binary.data); i++)
+    {
+        JsonbValue *elem = getIthJsonbValueFromContainer(sheets->val.binary.data, i);
+        JsonbValue *props;
+        JsonbValue *title;
+        JsonbValue *gid;
+
+        if (elem == NULL || elem->type != jbvBinary)
+            continue;
+        props = getKeyJsonValueFromContainer(elem->val.binary.data, "properties", 10, NULL);
+        if (props == NULL || props->type != jbvBinary)
+            continue;
+        title = getKeyJsonValueFromContainer(props->val.binary.data, "title", 5, NULL);
+        if (title == NULL || title->type != jbvString ||
+            title->val.string.len != strlen(sheet) ||
+            strncmp(title->val.string.val, sheet, title->val.string.len) != 0)
+            continue;
+
+        /* The first sheet's id is zero, which the API may leave out */
+        gid = getKeyJsonValueFromContainer(props->val.binary.data, "sheetId", 7, NULL);
+        if (gid == NULL || gid->type != jbvNumeric)
+            return 0;
+        return DatumGetInt32(DirectFunctionCall1(numeric_int4, NumericGetDatum(gid->val.numeric)));
+    }
+
+    ereport(ERROR,
+            (errcode(ERRCODE_UNDEFINED_OBJECT),
+             errmsg("Sheet \"%s\" not found", sheet)));
+    return 0;                   /* keep compiler quiet */
+}
+
+static void csv_read_row(char **fields, int nfields, void *arg)
+{
+    csv_read_state *state = (csv_read_state *) arg;
+    TupleDesc tupdesc = state->tupdesc;
+    MemoryContext oldcontext;
+
+    if (state->skip_row)
+    {
+        state->skip_row = false;
+        return;
+    }
+
+    oldcontext = MemoryContextSwitchTo(state->row_mcxt);
+
+    for (int i = 0; i < tupdesc->natts; i++)
+    {
+        Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+
+        if (i >= nfields || (fields[i][0] == '\0' && att->atttypid != TEXTOID))
+        {
+            state->values[i] = (Datum) 0;
+            state->nulls[i] = true;
+        }
+        else
+        {
+            state->values[i] = InputFunctionCall(&state->in_funcs[i], fields[i],
+                                                 state->typioparams[i], att->atttypmod);
+            state->nulls[i] = false;
+        }
+    }
+
+    tuplestore_putvalues(state->tupstore, tupdesc, state->values, state->nulls);
+    TRACE_GSHEETS_TUPLE_EMIT(tuplestore_tuple_count(state->tupstore));
+
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextReset(state->row_mcxt);
+}
+
+/* Stream sink parsing CSV into the CsvParser 'arg' */
+void csv_feed(const char *data, size_t len, void *arg)
+{
+    TRACE_GSHEETS_PARSE_START(len);
+    pgstat_report_wait_start(gsheets_wait_event(WAIT_PARSE));
+    csv_parser_feed((CsvParser *) arg, data, len);
+    pgstat_report_wait_end();
+    TRACE_GSHEETS_PARSE_DONE(len);
+}
+
+/*
+ * Read a sheet through its CSV export.  The body is parsed as it streams in
+ * and tuples are built straight from the fields using the input functions of
+ * the query's column definition list, with no JSON step.
+ */
+static void read_sheet_csv(ReturnSetInfo *rsinfo, const char *id, const char *sheet, bool header,
+                           struct curl_slist *headers)
+{
+    csv_read_state state;
+    CsvParser parser;
+    MemoryContext oldcontext;
+    char *params[2];
+    int natts;
+
+    if (rsinfo->expectedDesc == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("A column definition list is required for the csv format")));
+
+    params[0] = "format=csv";
+    params[1] = psprintf("gid=%d", sheet_gid(id, sheet, headers));
+
+    oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+    state.tupdesc = CreateTupleDescCopy(rsinfo->expectedDesc);
+    state.tupstore = tuplestore_begin_heap(true, false, work_mem);
+    rsinfo->setResult = state.tupstore;
+    rsinfo->setDesc = state.tupdesc;
+    MemoryContextSwitchTo(oldcontext);
+
+    natts = state.tupdesc->natts;
+    state.in_funcs = (FmgrInfo *) palloc(natts * sizeof(FmgrInfo));
+    state.typioparams = (Oid *) palloc(natts * sizeof(Oid));
+    state.values = (Datum *) palloc(natts * sizeof(Datum));
+    state.nulls = (bool *) palloc(natts * sizeof(bool));
+    for (int i = 0; i < natts; i++)
+    {
+        Oid func;
+
+        getTypeInputInfo(TupleDescAttr(state.tupdesc, i)->atttypid, &func, &state.typioparams[i]);
+        fmgr_info(func, &state.in_funcs[i]);
+    }
+
+    state.row_mcxt = AllocSetContextCreate(CurrentMemoryContext,
+                                           "read_sheet csv row",
+                                           ALLOCSET_DEFAULT_SIZES);
+    /* The export always starts at row 1, which is the header row */
+    state.skip_row = !header;
+
+    csv_parser_init(&parser, csv_read_row, &state);
+    http_get_stream(EXPORT_URL(id), params, 2, headers, csv_feed, &parser);
+    csv_parser_finish(&parser);
+
+    MemoryContextDelete(state.row_mcxt);
+}
+
+PG_FUNCTION_INFO_V1(gsheets_http_stats);
+Datum gsheets_http_stats(PG_FUNCTION_ARGS)
+{
+    const HttpStats *stats = http_get_stats();
+    TupleDesc tupdesc;
+    Datum values[3];
+    bool nulls[3] = {false, false, false};
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        ereport(ERROR, (errmsg("return type must be a row type")));
+
+    values[0] = Int64GetDatum(stats->requests);
+    values[1] = Int64GetDatum(stats->hedged);
+    values[2] = Int64GetDatum(stats->hedge_wins);
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
 PG_FUNCTION_INFO_V1(read_sheet);
 Datum read_sheet(PG_FUNCTION_ARGS)
 {
@@ -382,40 +2008,29 @@ Datum read_sheet(PG_FUNCTION_ARGS)
     Tuplestorestate *tupstore;
     char *id;
     bool header = PG_GETARG_BOOL(2);
+    /* Sheet row the range starts at: without the header, the row below it */
+    int start_row = header ? 1 : 2;
     char *sheet;
+    char *range;
     char *response;
-    Jsonb *jsonb;
-    JsonbValue v;
-    JsonbIterator *it;
-    JsonbIteratorToken r;
-    int nElems = 0;
-    bool is_row = false;
-    int col = 0;
+    char *params[] = {
+        "valueRenderOption=UNFORMATTED_VALUE",
+        "dateTimeRenderOption=SERIAL_NUMBER"
+    };
+    JsonbValue *rows;
+    JsonbValue **formatted = NULL;
+    JsonbValue *first;
+    int first_row = 0;
+    int nrows;
+    int ncols;
     Datum *values;
     bool *nulls;
+    MemoryContext row_mcxt;
     List *types = NIL;
-    struct curl_slist *headers = NULL;
+    struct curl_slist *headers = auth_headers();
 
-    if (access_token != NULL && strlen(access_token) != 0)
-        headers = add_header(headers, "Authorization", psprintf("Bearer %s", access_token));
-    else
-        ereport(ERROR,
-                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                 errmsg("Access token is required"),
-                 errhint("Set gsheets.access_token")));
-    
     if (!PG_ARGISNULL(0))
-    {
-        char *url = text_to_cstring(PG_GETARG_TEXT_P(0));
-        if (validate_url(url))
-            id = extract_id(url);
-        else if (strlen(url) == 44)
-            id = url;
-        else
-            ereport(ERROR,
-                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                    errmsg("Invalid URL or sheet id")));
-    }
+        id = sheet_id_from_link(text_to_cstring(PG_GETARG_TEXT_P(0)));
     else
         ereport(ERROR,
             (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
@@ -427,10 +2042,6 @@ Datum read_sheet(PG_FUNCTION_ARGS)
                  errmsg("Sheet name is required")));
     sheet = text_to_cstring(PG_GETARG_TEXT_P(1));
 
-    response = http_get(SHEET_URL(id, header ? sheet : psprintf("%s!A2:Z", sheet)),
-                        NULL, 0, headers);
-    jsonb = DatumGetJsonbP(DirectFunctionCall1(jsonb_in, CStringGetDatum(response)));
-
     if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
         ereport(ERROR, (errmsg("SRF called in non-SRF context")));
     if (rsinfo->allowedModes & SFRM_Materialize)
@@ -438,80 +2049,105 @@ Datum read_sheet(PG_FUNCTION_ARGS)
     else
         ereport(ERROR, (errmsg("Materialize mode required")));
 
+    if (PG_NARGS() > 3 && !PG_ARGISNULL(3))
+    {
+        char *format = text_to_cstring(PG_GETARG_TEXT_P(3));
+
+        if (strcmp(format, "csv") == 0)
+        {
+            read_sheet_csv(rsinfo, id, sheet, header, headers);
+            curl_slist_free_all(headers);
+            PG_RETURN_VOID();
+        }
+        else if (strcmp(format, "json") != 0)
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("Invalid format \"%s\"", format),
+                     errhint("Use \"json\" or \"csv\".")));
+    }
+
+    /*
+     * Inferred columns are built from unformatted values, formatting would
+     * lose precision and dates would depend on the spreadsheet's locale.
+     */
+    range = start_row == 1 ? sheet : psprintf("%s!A%d:Z", sheet, start_row);
+    response = http_get(SHEET_URL(id, range), params, enable_infer_types ? 2 : 0, headers);
+    rows = sheet_rows(parse_json(response));
+    free(response);
+
+    if (rows == NULL)
+    {
+        curl_slist_free_all(headers);
+        PG_RETURN_VOID();
+    }
+
+    /* The header row names the columns, typed columns could not hold it */
+    if (enable_infer_types)
+    {
+        types = sheet_types(id, sheet, header, start_row, rows, headers);
+        first_row = header ? 1 : 0;
+
+        /* Text columns show numbers as they are formatted in the sheet */
+        formatted = formatted_columns(id, sheet, start_row, rows, first_row, types, headers);
+    }
+
+    first = getIthJsonbValueFromContainer(rows->val.binary.data, 0);
+    ncols = first != NULL && first->type == jbvBinary ? JsonContainerSize(first->val.binary.data) : 0;
+    if (ncols == 0)
+    {
+        curl_slist_free_all(headers);
+        PG_RETURN_VOID();
+    }
+
     oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
 
+    tupdesc = CreateTemplateTupleDesc(ncols);
+    for (int i = 0; i < ncols; i++)
+    {
+        if (i < list_length(types))
+            TupleDescInitEntry(tupdesc, i + 1, NULL, list_nth_oid(types, i), -1, 0);
+        else
+            TupleDescInitEntry(tupdesc, i + 1, NULL, TEXTOID, -1, 0);
+    }
+    BlessTupleDesc(tupdesc);
+    rsinfo->setDesc = tupdesc;
+
     tupstore = tuplestore_begin_heap(true, false, work_mem);
     rsinfo->setResult = tupstore;
-    rsinfo->setDesc = NULL;
 
-    it = JsonbIteratorInit(&jsonb->root);
-    while ((r = JsonbIteratorNext(&it, &v, false)) != WJB_DONE)
-    {
-        if (r == WJB_BEGIN_ARRAY)
-        {
-            if (!is_row)
-                is_row = true;
-            else
-                nElems = v.val.array.nElems;
+    MemoryContextSwitchTo(oldcontext);
 
-            // Set up tuple descriptor once we know the column count
-            if (rsinfo->setDesc == NULL && nElems > 0) {
-                tupdesc = CreateTemplateTupleDesc(nElems);
-                for (int i = 0; i < nElems; i++) {
-                    if (enable_infer_types)
-                    {
-                        Oid typid;
+    values = (Datum *) palloc(ncols * sizeof(Datum));
+    nulls = (bool *) palloc(ncols * sizeof(bool));
+    row_mcxt = AllocSetContextCreate(CurrentMemoryContext, "read_sheet row", ALLOCSET_DEFAULT_SIZES);
 
-                        types = infer_types(id, sheet, header);
-                        typid = list_nth_oid(types, i);
-                        TupleDescInitEntry(tupdesc, i + 1, NULL, typid, -1, 0);
-                    }
-                    else
-                        TupleDescInitEntry(tupdesc, i + 1, NULL, TEXTOID, -1, 0);
-                }
-                BlessTupleDesc(tupdesc);
-                rsinfo->setDesc = tupdesc;
-            }
-        }
-        else if (r == WJB_ELEM)
+    nrows = JsonContainerSize(rows->val.binary.data);
+    for (int r = first_row; r < nrows; r++)
+    {
+        oldcontext = MemoryContextSwitchTo(row_mcxt);
+
+        for (int c = 0; c < ncols; c++)
         {
-            char *val;
-            Oid typid;
-            if (col == 0)
-            {
-                values = (Datum *)palloc(nElems * sizeof(Datum));
-                nulls = (bool *)palloc(nElems * sizeof(bool));
-            }
+            Oid typid = c < list_length(types) ? list_nth_oid(types, c) : TEXTOID;
+            JsonbValue *cell;
 
-            val = pnstrdup(v.val.string.val, v.val.string.len);
-            if (enable_infer_types)
-            {
-                typid = list_nth_oid(types, col);
-                if (typid == INT8OID)
-                    values[col] = DirectFunctionCall1(int4in, CStringGetDatum(val));
-                else if (typid == BOOLOID)
-                    values[col] = DirectFunctionCall1(boolin, CStringGetDatum(val));
-                else if (typid == DATEOID)
-                    values[col] = DirectFunctionCall1(date_in, CStringGetDatum(val));
-                else
-                    values[col] = CStringGetTextDatum(val);
-            }
+            if (formatted != NULL && c < list_length(types) && formatted[c] != NULL)
+                cell = sheet_cell(formatted[c], r, 0);
             else
-                values[col] = CStringGetTextDatum(val);
-
-            nulls[col] = false;
-            col++;
+                cell = sheet_cell(rows, r, c);
 
-            if (col == nElems)
-            {
-                tuplestore_putvalues(tupstore, rsinfo->setDesc, values, nulls);
-                col = 0;
-            }
+            values[c] = cell_datum(cell, typid, &nulls[c]);
         }
+
+        tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+        TRACE_GSHEETS_TUPLE_EMIT(tuplestore_tuple_count(tupstore));
+
+        MemoryContextSwitchTo(oldcontext);
+        MemoryContextReset(row_mcxt);
     }
 
-    MemoryContextSwitchTo(oldcontext);
-    free(response);
+    MemoryContextDelete(row_mcxt);
+    curl_slist_free_all(headers);
     PG_RETURN_VOID();
 }
 
@@ -526,17 +2162,26 @@ Datum read_sheet(PG_FUNCTION_ARGS)
  *      - spreadsheet_name: the name of the spreadsheet
  *      - sheet_name: the name of the sheet
  *      - header: whether to include a header
+ *      - partition_by: column naming the sheet of each row
+ *      - typed: send typed cells instead of strings
  *      - will be adding more options in the future
  */
 PG_FUNCTION_INFO_V1(write_sheet_transition);
 Datum write_sheet_transition(PG_FUNCTION_ARGS)
 {
     write_state *state;
+    MemoryContext aggcontext;
     MemoryContext old_mcxt;
     int nargs;
     Datum *args;
     bool *nulls;
     Oid *types;
+    write_target *target;
+
+    if (!AggCheckCallContext(fcinfo, &aggcontext))
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("write_sheet_transition called in non-aggregate context")));
 
     nargs = extract_variadic_args(fcinfo, 1, true, &args, &types, &nulls);
 
@@ -544,6 +2189,7 @@ Datum write_sheet_transition(PG_FUNCTION_ARGS)
     if (PG_ARGISNULL(0))
     {
         char *spreadsheet_name = NULL;
+        MemoryContext state_mcxt;
 
         if (nargs < 1 || nargs > 2)
             ereport(ERROR,
@@ -555,21 +2201,39 @@ Datum write_sheet_transition(PG_FUNCTION_ARGS)
                     (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                     errmsg("Options must be a JSONB object")));
 
-        /* Switch to the memory context of calling function */
-        old_mcxt = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+        /* Everything the state owns lives in its own context, freed by the final function */
+        state_mcxt = AllocSetContextCreate(aggcontext,
+                                           "write_sheet state",
+                                           ALLOCSET_DEFAULT_SIZES);
+        old_mcxt = MemoryContextSwitchTo(state_mcxt);
 
         state = (write_state *) palloc0(sizeof(write_state));
         state->tcount = 0;
-        state->count = 0;
+        state->pending = 0;
         state->spreadsheet_id = NULL;
         state->sheet_name = NULL;
+        state->state_mcxt = state_mcxt;
+        state->row_mcxt = AllocSetContextCreate(state_mcxt,
+                                                "write_sheet row",
+                                                ALLOCSET_DEFAULT_SIZES);
 
         if (nargs == 2)
         {
             state->spreadsheet_id = extract_text_from_jsonb(DatumGetJsonbP(args[1]), "spreadsheet_id");
             state->sheet_name = extract_text_from_jsonb(DatumGetJsonbP(args[1]), "sheet_name");
             spreadsheet_name = extract_text_from_jsonb(DatumGetJsonbP(args[1]), "spreadsheet_name");
+            state->partition_by = extract_text_from_jsonb(DatumGetJsonbP(args[1]), "partition_by");
+            state->typed = extract_bool_from_jsonb(DatumGetJsonbP(args[1]), "typed");
+            if (state->typed)
+                state->header = header_cells(DatumGetJsonbP(args[1]), &state->header_width);
+            else
+                state->header = header_row(DatumGetJsonbP(args[1]));
         }
+
+        if (state->partition_by != NULL && !type_is_rowtype(types[0]))
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                    errmsg("partition_by requires a row as data")));
         
         if (state->sheet_name == NULL)
             state->sheet_name = "Sheet1";
@@ -582,118 +2246,129 @@ Datum write_sheet_transition(PG_FUNCTION_ARGS)
                     (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                     errmsg("Invalid sheet id")));
 
-        initialize_buffer(&state->buff);
+        /* The header list is malloc'd by curl, free it with the state, also on error */
+        state->headers = auth_headers();
+        state->headers = add_header(state->headers, "Content-Type", "application/json");
+        {
+            MemoryContextCallback *cb = palloc(sizeof(MemoryContextCallback));
 
-        // Write the header if available
-        if (nargs == 2)
-            write_header(DatumGetJsonbP(args[1]), state);
+            cb->func = free_write_headers;
+            cb->arg = state;
+            MemoryContextRegisterResetCallback(state_mcxt, cb);
+        }
+
+        initStringInfo(&state->url);
+        initStringInfo(&state->buff);
+
+        /*
+         * Partitions may need new tabs and typed writes address tabs by id,
+         * remember the ones already there
+         */
+        if (state->partition_by != NULL || state->typed)
+            state->existing_tabs = sheet_tabs(state->spreadsheet_id, state->headers);
+        if (state->partition_by == NULL)
+            get_target(state, state->sheet_name);
 
         MemoryContextSwitchTo(old_mcxt);
+        write_mem_peak = 0;
     }
     else
         /* Get the state from the previous call */
         state = (write_state *) PG_GETARG_POINTER(0);
 
-    appendStringInfoChar(&state->buff, '[');
+    /*
+     * Everything allocated while formatting the row goes to the row context;
+     * the target buffers grow in the state context and are never reallocated
+     * once they have held a full batch.
+     */
+    old_mcxt = MemoryContextSwitchTo(state->row_mcxt);
 
-    if (type_is_rowtype(types[0]))
+    if (nulls[0])
+    {
+        /* A NULL row is left empty, a NULL value is an empty cell */
+        target = get_target(state, state->sheet_name);
+        if (state->typed)
+            appendStringInfoString(&target->rows, "{}");
+        else
+            appendStringInfoString(&target->rows, type_is_rowtype(types[0]) ? "[]" : "[\"\"]");
+    }
+    else if (type_is_rowtype(types[0]))
     {
-        Oid			tupType;
-        int32		tupTypmod;
-        TupleDesc	tupdesc;
         HeapTupleHeader rec;
         HeapTupleData tuple;
-        Datum *values;
-        bool *_nulls;
-        
+        TupleDesc tupdesc;
+        int ncells = 0;
+
         rec = DatumGetHeapTupleHeader(args[0]);
         /*
          * Extract type info from the tuple itself -- this will work even for
          * anonymous record types.
          */
-        tupType = HeapTupleHeaderGetTypeId(rec);
-        tupTypmod = HeapTupleHeaderGetTypMod(rec);
+        prepare_output(state, HeapTupleHeaderGetTypeId(rec), HeapTupleHeaderGetTypMod(rec));
+        tupdesc = lookup_rowtype_tupdesc_domain(state->out_type, state->out_typmod, false);
 
-        tupdesc = lookup_rowtype_tupdesc_domain(tupType, tupTypmod, false);
+        /* Build a temporary HeapTuple control structure */
+        tuple.t_len = HeapTupleHeaderGetDatumLength(rec);
+        ItemPointerSetInvalid(&(tuple.t_self));
+        tuple.t_tableOid = InvalidOid;
+        tuple.t_data = rec;
 
-        if (rec)
-        {
-            /* Build a temporary HeapTuple control structure */
-            tuple.t_len = HeapTupleHeaderGetDatumLength(rec);
-            ItemPointerSetInvalid(&(tuple.t_self));
-            tuple.t_tableOid = InvalidOid;
-            tuple.t_data = rec;
-
-            values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
-            _nulls = (bool *) palloc(tupdesc->natts * sizeof(bool));
+        /* Break down the tuple into fields */
+        heap_deform_tuple(&tuple, tupdesc, state->values, state->nulls);
 
-            /* Break down the tuple into fields */
-            heap_deform_tuple(&tuple, tupdesc, values, _nulls);
+        target = get_target(state, row_sheet_name(state, tupdesc));
+        appendStringInfoString(&target->rows, state->typed ? "{\"values\":[" : "[");
+        for (int i = 0; i < tupdesc->natts; i++)
+        {
+            if (TupleDescAttr(tupdesc, i)->attisdropped)
+                continue;
 
-            for (int i = 0; i < tupdesc->natts; i++)
-            {
-                char *val;
-                if (_nulls[i])
-                    val = "";
-                else
-                {
-                    Oid typoutput;
-                    bool typIsVarlena;
-                    getTypeOutputInfo(tupdesc->attrs[i].atttypid, &typoutput, &typIsVarlena);
-                    val = OidOutputFunctionCall(typoutput, values[i]);
-                }
+            if (ncells++ > 0)
+                appendStringInfoChar(&target->rows, ',');
 
-                if (i < tupdesc->natts - 1)
-                    appendStringInfo(&state->buff, "\"%s\",", val);
-                else
-                    appendStringInfo(&state->buff, "\"%s\"", val);
-            }
-        }
-        else
-        {
-            values = NULL;
-            _nulls = NULL;
+            if (state->nulls[i])
+                appendStringInfoString(&target->rows, state->typed ? "{}" : "\"\"");
+            else if (state->typed)
+                typed_cell(&target->rows, state->att_types[i], state->values[i], &state->out_funcs[i]);
+            else
+                escape_json(&target->rows, OutputFunctionCall(&state->out_funcs[i], state->values[i]));
         }
+        appendStringInfoString(&target->rows, state->typed ? "]}" : "]");
+        target->width = Max(target->width, ncells);
         ReleaseTupleDesc(tupdesc);
     }
     else
     {
-        char *val;
-        if (nulls[0])
-            val = "";
+        target = get_target(state, state->sheet_name);
+        prepare_output(state, types[0], -1);
+        if (state->typed)
+        {
+            appendStringInfoString(&target->rows, "{\"values\":[");
+            typed_cell(&target->rows, state->att_types[0], args[0], &state->out_funcs[0]);
+            appendStringInfoString(&target->rows, "]}");
+        }
         else
         {
-            Oid typoutput;
-            bool typIsVarlena;
-
-            getTypeOutputInfo(types[0], &typoutput, &typIsVarlena);
-            val = OidOutputFunctionCall(typoutput, args[0]);
+            appendStringInfoChar(&target->rows, '[');
+            escape_json(&target->rows, OutputFunctionCall(&state->out_funcs[0], args[0]));
+            appendStringInfoChar(&target->rows, ']');
         }
-        appendStringInfo(&state->buff, "\"%s\"", val);
+        target->width = Max(target->width, 1);
     }
 
-    appendStringInfoChar(&state->buff, ']');
+    appendStringInfoChar(&target->rows, ',');
+
+    MemoryContextSwitchTo(old_mcxt);
+    track_write_memory(state);
+    MemoryContextReset(state->row_mcxt);
 
     // Increment the count
     state->tcount++;
-    state->count++;
-
-    if (state->count >= 2000)
-    {
-        close_buffer(&state->buff);
-        write_to_gsheet(state);
-
-        /* Swicth to the appropriate memory context */
-        old_mcxt = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
-
-        state->count = 0;
-        resetStringInfo(&state->buff);
-        initialize_buffer(&state->buff);
+    state->pending++;
+    target->count++;
 
-        MemoryContextSwitchTo(old_mcxt);
-    }
-    else
-        appendStringInfoChar(&state->buff, ',');
+    if (state->pending >= 2000)
+        flush_rows(state);
 
     PG_RETURN_POINTER(state);
 }
@@ -701,18 +2376,107 @@ Datum write_sheet_transition(PG_FUNCTION_ARGS)
 PG_FUNCTION_INFO_V1(write_sheet_final);
 Datum write_sheet_final(PG_FUNCTION_ARGS)
 {
-    write_state *state = (write_state *) PG_GETARG_POINTER(0);
+    write_state *state;
 
-    close_buffer(&state->buff);
-    write_to_gsheet(state);
+    /* No input rows */
+    if (PG_ARGISNULL(0))
+        PG_RETURN_VOID();
+
+    state = (write_state *) PG_GETARG_POINTER(0);
+
+    if (state->pending > 0)
+        flush_rows(state);
 
     elog(INFO, "%d rows written at %s", state->tcount,
          psprintf("https://docs.google.com/spreadsheets/d/%s", state->spreadsheet_id));
 
-    /* cleanup */
-    resetStringInfo(&state->buff);
-    pfree(state->buff.data);
-    pfree(state);
+    /* cleanup, this also frees the request headers */
+    track_write_memory(state);
+    MemoryContextDelete(state->state_mcxt);
 
     PG_RETURN_VOID();
-}
\ No newline at end of file
+}
+
+PG_FUNCTION_INFO_V1(gsheets_write_memory);
+Datum gsheets_write_memory(PG_FUNCTION_ARGS)
+{
+    TupleDesc tupdesc;
+    Datum values[2];
+    bool nulls[2] = {false, false};
+
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+        ereport(ERROR, (errmsg("return type must be a row type")));
+
+    values[0] = Int64GetDatum(write_mem_current);
+    values[1] = Int64GetDatum(write_mem_peak);
+
+    PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+/*
+ * Inspection functions for the regression tests: the type inferred for a
+ * Sheets API cell, the value read_sheet builds from an unformatted cell,
+ * and the cell a typed write_sheet sends for a value.
+ */
+PG_FUNCTION_INFO_V1(gsheets_cell_type);
+Datum gsheets_cell_type(PG_FUNCTION_ARGS)
+{
+    Jsonb *jb = PG_GETARG_JSONB_P(0);
+    JsonbValue cell;
+    Oid typid;
+
+    cell.type = jbvBinary;
+    cell.val.binary.data = &jb->root;
+    cell.val.binary.len = VARSIZE(jb) - VARHDRSZ;
+
+    typid = cell_type(&cell);
+    if (typid == InvalidOid)
+        PG_RETURN_NULL();
+    PG_RETURN_OID(typid);
+}
+
+PG_FUNCTION_INFO_V1(gsheets_cell_value);
+Datum gsheets_cell_value(PG_FUNCTION_ARGS)
+{
+    Jsonb *jb = PG_GETARG_JSONB_P(0);
+    Oid typid = PG_GETARG_OID(1);
+    JsonbValue cell;
+    Oid typoutput;
+    bool typIsVarlena;
+    bool isnull;
+    Datum value;
+
+    if (!inferable_type(typid))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("Type %s is never inferred", format_type_be(typid))));
+    if (!JsonbExtractScalar(&jb->root, &cell))
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("Cell value must be a JSON scalar")));
+
+    value = cell_datum(&cell, typid, &isnull);
+    if (isnull)
+        PG_RETURN_NULL();
+
+    getTypeOutputInfo(typid, &typoutput, &typIsVarlena);
+    PG_RETURN_TEXT_P(cstring_to_text(OidOutputFunctionCall(typoutput, value)));
+}
+
+PG_FUNCTION_INFO_V1(gsheets_typed_cell);
+Datum gsheets_typed_cell(PG_FUNCTION_ARGS)
+{
+    Oid typid = get_fn_expr_argtype(fcinfo->flinfo, 0);
+    Oid typoutput;
+    bool typIsVarlena;
+    FmgrInfo out_func;
+    StringInfoData buf;
+
+    getTypeOutputInfo(typid, &typoutput, &typIsVarlena);
+    fmgr_info(typoutput, &out_func);
+
+    initStringInfo(&buf);
+    typed_cell(&buf, getBaseType(typid), PG_GETARG_DATUM(0), &out_func);
+
+    PG_RETURN_DATUM(DirectFunctionCall1(jsonb_in, CStringGetDatum(buf.data)));
+}
@@ -0,0 +1,40 @@
+#ifndef GSHEETS_H
+#define GSHEETS_H
+
+#include "utils/http_helpers.h"
+#include "utils/jsonb.h"
+
+/* A tab of a spreadsheet, with its grid size */
+typedef struct sheet_tab {
+    char *title;
+    int sheet_id;
+    int nrows;
+    int ncols;
+} sheet_tab;
+
+extern char *access_token;
+extern int infer_sample_rows;
+
+extern char *sheet_id_from_link(const char *link);
+extern struct curl_slist *auth_headers(void);
+extern char *quote_sheet_name(const char *title);
+extern char *column_letter(int n);
+
+extern Jsonb *parse_json(const char *response);
+extern Jsonb *api_response(char *response, const char *id);
+extern Jsonb *fetch_metadata(const char *id, char **params, int nparams, struct curl_slist *headers);
+extern List *sheet_tabs(const char *id, struct curl_slist *headers);
+extern void csv_feed(const char *data, size_t len, void *arg);
+
+extern JsonbValue *fetch_values(const char *id, const char *range, struct curl_slist *headers);
+extern JsonbValue *sheet_cell(JsonbValue *rows, int r, int c);
+extern Datum value_datum(JsonbValue *cell, Oid typid, FmgrInfo *in_func, Oid typioparam, int32 typmod,
+                         bool keep_empty, bool *isnull);
+
+extern Oid widen_type(Oid current, Oid next);
+extern Oid cell_type(JsonbValue *cell);
+extern char *schema_revision(List *names, int ncols);
+extern void store_schema(const char *id, const char *sheet, const char *revision,
+                         List *names, List *types);
+
+#endif // GSHEETS_H
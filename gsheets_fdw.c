@@ -0,0 +1,1496 @@
+#include "postgres.h"
+
+#include "access/reloptions.h"
+#include "access/stratnum.h"
+#include "access/sysattr.h"
+#include "access/table.h"
+#include "catalog/pg_aggregate.h"
+#include "catalog/pg_attribute.h"
+#include "catalog/pg_foreign_table.h"
+#include "catalog/pg_namespace.h"
+#include "catalog/pg_type.h"
+#include "commands/defrem.h"
+#include "commands/explain.h"
+#if PG_VERSION_NUM >= 180000
+#include "commands/explain_format.h"
+#endif
+#include "foreign/fdwapi.h"
+#include "foreign/foreign.h"
+#include "mb/pg_wchar.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/cost.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/planmain.h"
+#include "optimizer/tlist.h"
+#include "utils/builtins.h"
+#include "utils/csv_parser.h"
+#include "utils/date.h"
+#include "utils/datetime.h"
+#include "utils/jsonb.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/selfuncs.h"
+#include "utils/timestamp.h"
+#include "utils/tracing.h"
+#include "utils/tuplestore.h"
+#include "miscadmin.h"
+#include "funcapi.h"
+
+#include "gsheets.h"
+
+#define GVIZ_URL(id) psprintf("https://docs.google.com/spreadsheets/d/%s/gviz/tq", id)
+
+/* Rows assumed for a sheet that has never been analyzed */
+#define DEFAULT_SHEET_ROWS 1000
+/* Cost of a round trip to Google, and of transferring a row */
+#define DEFAULT_STARTUP_COST 100.0
+#define DEFAULT_TRANSFER_COST 0.01
+
+/* Kinds of values the visualization query language can compare */
+typedef enum GvizClass {
+    GVIZ_NONE,
+    GVIZ_NUMBER,
+    GVIZ_STRING,
+    GVIZ_BOOLEAN,
+    GVIZ_DATE,
+    GVIZ_DATETIME
+} GvizClass;
+
+/*
+ * Planner state of a foreign table, or of an aggregation pushed down on top
+ * of one.
+ */
+typedef struct GSheetsFdwRelationInfo {
+    char *spreadsheet_id;
+    char *sheet_name;
+    bool header;
+    Index relid;                /* range table index of the foreign table */
+    int natts;
+    char **columns;             /* sheet column of each attribute, by attnum - 1 */
+    List *remote_conds;         /* RestrictInfos evaluated by Google */
+    List *local_conds;          /* RestrictInfos evaluated locally */
+    Bitmapset *attrs_used;      /* attributes needed locally */
+    Bitmapset *filled_attrs;    /* attributes pushed-down quals prove non-empty */
+    double remote_rows;         /* rows returned by Google */
+
+    /* Aggregation pushdown only */
+    bool grouped;
+    List *group_exprs;          /* Vars of the GROUP BY clause */
+    List *grouped_tlist;        /* TargetEntries returned by the query */
+} GSheetsFdwRelationInfo;
+
+/* Execution state of a foreign scan */
+typedef struct GSheetsFdwScanState {
+    char *spreadsheet_id;
+    char *sheet_name;
+    bool header;
+    char *query;
+    TupleDesc tupdesc;
+    int npositions;
+    int *positions;             /* slot attribute of each returned column, 0 to skip */
+    int *cells;                 /* its sheet column when reading values, else NULL */
+    FmgrInfo *in_funcs;
+    Oid *typioparams;
+    Datum *values;
+    bool *nulls;
+    bool skip_row;
+    bool fetched;
+    Tuplestorestate *tupstore;
+    TupleTableSlot *fetch_slot;
+    MemoryContext row_mcxt;
+} GSheetsFdwScanState;
+
+static void gsheetsGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
+static void gsheetsGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid);
+static ForeignScan *gsheetsGetForeignPlan(PlannerInfo *root, RelOptInfo *foreignrel, Oid foreigntableid,
+                                          ForeignPath *best_path, List *tlist, List *scan_clauses,
+                                          Plan *outer_plan);
+static void gsheetsGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+                                        RelOptInfo *input_rel, RelOptInfo *output_rel, void *extra);
+static void gsheetsBeginForeignScan(ForeignScanState *node, int eflags);
+static TupleTableSlot *gsheetsIterateForeignScan(ForeignScanState *node);
+static void gsheetsReScanForeignScan(ForeignScanState *node);
+static void gsheetsEndForeignScan(ForeignScanState *node);
+static void gsheetsExplainForeignScan(ForeignScanState *node, ExplainState *es);
+static List *gsheetsImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid);
+
+static bool deparse_expr(Node *node, GSheetsFdwRelationInfo *fpinfo, StringInfo buf);
+
+/*
+ * create_foreignscan_path() and create_foreign_upper_path() grew arguments
+ * over the releases.
+ */
+#if PG_VERSION_NUM >= 180000
+#define create_scan_path(root, rel, rows, startup, total, pathkeys, private) \
+    create_foreignscan_path(root, rel, NULL, rows, 0, startup, total, pathkeys, NULL, NULL, NIL, private)
+#define create_upper_path(root, rel, target, rows, startup, total, private) \
+    create_foreign_upper_path(root, rel, target, rows, 0, startup, total, NIL, NULL, NIL, private)
+#elif PG_VERSION_NUM >= 170000
+#define create_scan_path(root, rel, rows, startup, total, pathkeys, private) \
+    create_foreignscan_path(root, rel, NULL, rows, startup, total, pathkeys, NULL, NULL, NIL, private)
+#define create_upper_path(root, rel, target, rows, startup, total, private) \
+    create_foreign_upper_path(root, rel, target, rows, startup, total, NIL, NULL, NIL, private)
+#else
+#define create_scan_path(root, rel, rows, startup, total, pathkeys, private) \
+    create_foreignscan_path(root, rel, NULL, rows, startup, total, pathkeys, NULL, NULL, private)
+#define create_upper_path(root, rel, target, rows, startup, total, private) \
+    create_foreign_upper_path(root, rel, target, rows, startup, total, NIL, NULL, private)
+#endif
+
+PG_FUNCTION_INFO_V1(gsheets_fdw_handler);
+Datum gsheets_fdw_handler(PG_FUNCTION_ARGS)
+{
+    FdwRoutine *routine = makeNode(FdwRoutine);
+
+    routine->GetForeignRelSize = gsheetsGetForeignRelSize;
+    routine->GetForeignPaths = gsheetsGetForeignPaths;
+    routine->GetForeignPlan = gsheetsGetForeignPlan;
+    routine->GetForeignUpperPaths = gsheetsGetForeignUpperPaths;
+    routine->BeginForeignScan = gsheetsBeginForeignScan;
+    routine->IterateForeignScan = gsheetsIterateForeignScan;
+    routine->ReScanForeignScan = gsheetsReScanForeignScan;
+    routine->EndForeignScan = gsheetsEndForeignScan;
+    routine->ExplainForeignScan = gsheetsExplainForeignScan;
+    routine->ImportForeignSchema = gsheetsImportForeignSchema;
+
+    PG_RETURN_POINTER(routine);
+}
+
+static bool is_column_letter(const char *column)
+{
+    if (*column == '\0')
+        return false;
+    for (const char *c = column; *c; c++)
+        if (*c < 'A' || *c > 'Z')
+            return false;
+    return true;
+}
+
+/*
+ * Options:
+ * - foreign table: spreadsheet (id or URL), sheet_name, header
+ * - column: column, the sheet column letter, by default the column's position
+ */
+PG_FUNCTION_INFO_V1(gsheets_fdw_validator);
+Datum gsheets_fdw_validator(PG_FUNCTION_ARGS)
+{
+    List *options = untransformRelOptions(PG_GETARG_DATUM(0));
+    Oid catalog = PG_GETARG_OID(1);
+    ListCell *lc;
+
+    foreach(lc, options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
+
+        if (catalog == ForeignTableRelationId && strcmp(def->defname, "spreadsheet") == 0)
+            (void) sheet_id_from_link(defGetString(def));
+        else if (catalog == ForeignTableRelationId && strcmp(def->defname, "sheet_name") == 0)
+            (void) defGetString(def);
+        else if (catalog == ForeignTableRelationId && strcmp(def->defname, "header") == 0)
+            (void) defGetBoolean(def);
+        else if (catalog == AttributeRelationId && strcmp(def->defname, "column") == 0)
+        {
+            if (!is_column_letter(defGetString(def)))
+                ereport(ERROR,
+                        (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                         errmsg("Invalid sheet column \"%s\"", defGetString(def)),
+                         errhint("Use a column letter such as \"A\" or \"AB\".")));
+        }
+        else
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                     errmsg("Invalid option \"%s\"", def->defname)));
+    }
+
+    PG_RETURN_VOID();
+}
+
+/* Zero based position of a sheet column letter */
+static int column_index(const char *letter)
+{
+    int n = 0;
+
+    for (const char *c = letter; *c; c++)
+        n = n * 26 + (*c - 'A' + 1);
+
+    return n - 1;
+}
+
+static void get_table_options(Oid relid, GSheetsFdwRelationInfo *fpinfo)
+{
+    ForeignTable *table = GetForeignTable(relid);
+    Relation rel;
+    TupleDesc tupdesc;
+    ListCell *lc;
+
+    fpinfo->spreadsheet_id = NULL;
+    fpinfo->sheet_name = "Sheet1";
+    fpinfo->header = true;
+
+    foreach(lc, table->options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
+
+        if (strcmp(def->defname, "spreadsheet") == 0)
+            fpinfo->spreadsheet_id = sheet_id_from_link(defGetString(def));
+        else if (strcmp(def->defname, "sheet_name") == 0)
+            fpinfo->sheet_name = defGetString(def);
+        else if (strcmp(def->defname, "header") == 0)
+            fpinfo->header = defGetBoolean(def);
+    }
+
+    if (fpinfo->spreadsheet_id == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_FDW_OPTION_NAME_NOT_FOUND),
+                 errmsg("Option \"spreadsheet\" is required for table \"%s\"", get_rel_name(relid))));
+
+    rel = table_open(relid, NoLock);
+    tupdesc = RelationGetDescr(rel);
+    fpinfo->natts = tupdesc->natts;
+    fpinfo->columns = (char **) palloc(tupdesc->natts * sizeof(char *));
+    fpinfo->filled_attrs = NULL;
+
+    for (int i = 0; i < tupdesc->natts; i++)
+    {
+        Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+
+        fpinfo->columns[i] = column_letter(i);
+        foreach(lc, GetForeignColumnOptions(relid, att->attnum))
+        {
+            DefElem *def = (DefElem *) lfirst(lc);
+
+            if (strcmp(def->defname, "column") == 0)
+                fpinfo->columns[i] = defGetString(def);
+        }
+    }
+
+    table_close(rel, NoLock);
+}
+
+static GvizClass gviz_class(Oid typid)
+{
+    switch (typid)
+    {
+        case INT2OID:
+        case INT4OID:
+        case INT8OID:
+        case FLOAT4OID:
+        case FLOAT8OID:
+        case NUMERICOID:
+            return GVIZ_NUMBER;
+        case TEXTOID:
+        case VARCHAROID:
+            return GVIZ_STRING;
+        case BOOLOID:
+            return GVIZ_BOOLEAN;
+        case DATEOID:
+            return GVIZ_DATE;
+        case TIMESTAMPOID:
+            return GVIZ_DATETIME;
+        default:
+            return GVIZ_NONE;
+    }
+}
+
+/* Output format requested for a returned column so it parses back reliably */
+static const char *gviz_format(GvizClass class)
+{
+    switch (class)
+    {
+        case GVIZ_NUMBER:
+            return "0.###############";
+        case GVIZ_DATE:
+            return "yyyy-MM-dd";
+        case GVIZ_DATETIME:
+            return "yyyy-MM-dd HH:mm:ss";
+        default:
+            return NULL;
+    }
+}
+
+/* The Var under any binary-compatible relabeling, if it is a column of ours */
+static Var *foreign_var(Node *node, GSheetsFdwRelationInfo *fpinfo)
+{
+    Var *var;
+
+    while (node != NULL && IsA(node, RelabelType))
+        node = (Node *) ((RelabelType *) node)->arg;
+
+    if (node == NULL || !IsA(node, Var))
+        return NULL;
+
+    var = (Var *) node;
+    if (var->varno != fpinfo->relid || var->varlevelsup != 0 ||
+        var->varattno <= 0 || var->varattno > fpinfo->natts)
+        return NULL;
+
+    return var;
+}
+
+static bool deparse_const(Const *c, GvizClass class, StringInfo buf)
+{
+    char *val;
+
+    if (c->constisnull || gviz_class(c->consttype) != class)
+        return false;
+
+    switch (class)
+    {
+        case GVIZ_NUMBER:
+            {
+                Oid typoutput;
+                bool typIsVarlena;
+
+                getTypeOutputInfo(c->consttype, &typoutput, &typIsVarlena);
+                val = OidOutputFunctionCall(typoutput, c->constvalue);
+                /* Rules out NaN and infinities */
+                if (strspn(val, "0123456789.-+eE") != strlen(val))
+                    return false;
+                appendStringInfoString(buf, val);
+            }
+            break;
+        case GVIZ_STRING:
+            /* The query language has no escapes, pick a quote the string lacks */
+            val = TextDatumGetCString(c->constvalue);
+            if (strchr(val, '"') == NULL)
+                appendStringInfo(buf, "\"%s\"", val);
+            else if (strchr(val, '\'') == NULL)
+                appendStringInfo(buf, "'%s'", val);
+            else
+                return false;
+            break;
+        case GVIZ_BOOLEAN:
+            appendStringInfoString(buf, DatumGetBool(c->constvalue) ? "true" : "false");
+            break;
+        case GVIZ_DATE:
+            {
+                DateADT date = DatumGetDateADT(c->constvalue);
+                int year, month, day;
+
+                if (DATE_NOT_FINITE(date))
+                    return false;
+                j2date(date + POSTGRES_EPOCH_JDATE, &year, &month, &day);
+                appendStringInfo(buf, "date '%04d-%02d-%02d'", year, month, day);
+            }
+            break;
+        case GVIZ_DATETIME:
+            {
+                Timestamp ts = DatumGetTimestamp(c->constvalue);
+                struct pg_tm tm;
+                fsec_t fsec;
+
+                if (TIMESTAMP_NOT_FINITE(ts) ||
+                    timestamp2tm(ts, NULL, &tm, &fsec, NULL, NULL) != 0 || fsec != 0)
+                    return false;
+                appendStringInfo(buf, "datetime '%04d-%02d-%02d %02d:%02d:%02d'",
+                                 tm.tm_year, tm.tm_mon, tm.tm_mday,
+                                 tm.tm_hour, tm.tm_min, tm.tm_sec);
+            }
+            break;
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Query language operator for a built-in comparison, with its operands
+ * swapped if 'commuted'.  Strings only get equality and LIKE, since ordering
+ * depends on collation, and != would skip the empty cells that are '' here.
+ */
+static const char *gviz_operator(Oid opno, GvizClass class, bool commuted)
+{
+    char *name;
+
+    if (opno >= FirstNormalObjectId || (name = get_opname(opno)) == NULL)
+        return NULL;
+
+    if (strcmp(name, "=") == 0)
+        return "=";
+    if (strcmp(name, "<>") == 0)
+        return class == GVIZ_STRING ? NULL : "!=";
+    if (strcmp(name, "~~") == 0)
+        return (class == GVIZ_STRING && !commuted) ? "like" : NULL;
+    if (class == GVIZ_STRING || class == GVIZ_BOOLEAN)
+        return NULL;
+    if (strcmp(name, "<") == 0)
+        return commuted ? ">" : "<";
+    if (strcmp(name, "<=") == 0)
+        return commuted ? ">=" : "<=";
+    if (strcmp(name, ">") == 0)
+        return commuted ? "<" : ">";
+    if (strcmp(name, ">=") == 0)
+        return commuted ? "<=" : ">=";
+
+    return NULL;
+}
+
+/*
+ * Append the query language form of a qual to 'buf'.  Returns false, leaving
+ * 'buf' in an unspecified state, if the qual cannot run at Google.
+ */
+static bool deparse_expr(Node *node, GSheetsFdwRelationInfo *fpinfo, StringInfo buf)
+{
+    if (node == NULL)
+        return false;
+
+    switch (nodeTag(node))
+    {
+        case T_BoolExpr:
+            {
+                BoolExpr *b = (BoolExpr *) node;
+                ListCell *lc;
+
+                /*
+                 * The query language treats comparisons with empty cells as
+                 * false rather than unknown, which agrees with SQL only as
+                 * long as nothing is negated.
+                 */
+                if (b->boolop == NOT_EXPR)
+                    return false;
+
+                appendStringInfoChar(buf, '(');
+                foreach(lc, b->args)
+                {
+                    if (lc != list_head(b->args))
+                        appendStringInfoString(buf, b->boolop == AND_EXPR ? " and " : " or ");
+                    if (!deparse_expr(lfirst(lc), fpinfo, buf))
+                        return false;
+                }
+                appendStringInfoChar(buf, ')');
+                return true;
+            }
+        case T_OpExpr:
+            {
+                OpExpr *op = (OpExpr *) node;
+                Var *var;
+                Node *other;
+                bool commuted = false;
+                GvizClass class;
+                const char *gop;
+
+                if (list_length(op->args) != 2)
+                    return false;
+
+                if ((var = foreign_var(linitial(op->args), fpinfo)) != NULL)
+                    other = lsecond(op->args);
+                else if ((var = foreign_var(lsecond(op->args), fpinfo)) != NULL)
+                {
+                    other = linitial(op->args);
+                    commuted = true;
+                }
+                else
+                    return false;
+
+                if (!IsA(other, Const))
+                    return false;
+
+                class = gviz_class(var->vartype);
+                if (class == GVIZ_NONE || (gop = gviz_operator(op->opno, class, commuted)) == NULL)
+                    return false;
+
+                if (class == GVIZ_STRING && !((Const *) other)->constisnull)
+                {
+                    char *val = TextDatumGetCString(((Const *) other)->constvalue);
+                    bool like = strcmp(gop, "like") == 0;
+
+                    /* LIKE patterns escape with backslashes, the query language cannot */
+                    if (like && strchr(val, '\\') != NULL)
+                        return false;
+                    /* Empty cells are null to Google, anything matching '' stays local */
+                    if (val[0] == '\0' || (like && strspn(val, "%") == strlen(val)))
+                        return false;
+                }
+
+                /* Unlike SQL, != holds for empty cells */
+                if (strcmp(gop, "!=") == 0)
+                    appendStringInfo(buf, "(%s is not null and ", fpinfo->columns[var->varattno - 1]);
+                appendStringInfo(buf, "%s %s ", fpinfo->columns[var->varattno - 1], gop);
+                if (!deparse_const((Const *) other, class, buf))
+                    return false;
+                if (strcmp(gop, "!=") == 0)
+                    appendStringInfoChar(buf, ')');
+                return true;
+            }
+        case T_NullTest:
+            {
+                NullTest *nt = (NullTest *) node;
+                Var *var = foreign_var((Node *) nt->arg, fpinfo);
+
+                /* Empty string cells are '' rather than null */
+                if (var == NULL || nt->argisrow || gviz_class(var->vartype) == GVIZ_STRING)
+                    return false;
+
+                appendStringInfo(buf, "%s %s", fpinfo->columns[var->varattno - 1],
+                                 nt->nulltesttype == IS_NULL ? "is null" : "is not null");
+                return true;
+            }
+        default:
+            return false;
+    }
+}
+
+static bool is_foreign_expr(Expr *expr, GSheetsFdwRelationInfo *fpinfo)
+{
+    StringInfoData buf;
+    bool ok;
+
+    initStringInfo(&buf);
+    ok = deparse_expr((Node *) expr, fpinfo, &buf);
+    pfree(buf.data);
+
+    return ok;
+}
+
+/*
+ * Columns a pushed-down qual proves non-empty: operands of strict
+ * comparisons.  NOT NULL is not enforced on the cells, so declaring it
+ * proves nothing.
+ */
+static void add_filled_attrs(Expr *expr, GSheetsFdwRelationInfo *fpinfo)
+{
+    Var *var = NULL;
+
+    if (IsA(expr, OpExpr))
+    {
+        OpExpr *op = (OpExpr *) expr;
+
+        var = foreign_var(linitial(op->args), fpinfo);
+        if (var == NULL)
+            var = foreign_var(lsecond(op->args), fpinfo);
+    }
+    else if (IsA(expr, NullTest) && ((NullTest *) expr)->nulltesttype == IS_NOT_NULL)
+        var = foreign_var((Node *) ((NullTest *) expr)->arg, fpinfo);
+
+    if (var != NULL)
+        fpinfo->filled_attrs = bms_add_member(fpinfo->filled_attrs, var->varattno);
+}
+
+static void gsheetsGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+    GSheetsFdwRelationInfo *fpinfo;
+    ListCell *lc;
+    double tuples;
+
+    fpinfo = (GSheetsFdwRelationInfo *) palloc0(sizeof(GSheetsFdwRelationInfo));
+    baserel->fdw_private = fpinfo;
+    fpinfo->relid = baserel->relid;
+    get_table_options(foreigntableid, fpinfo);
+
+    foreach(lc, baserel->baserestrictinfo)
+    {
+        RestrictInfo *ri = lfirst_node(RestrictInfo, lc);
+
+        if (is_foreign_expr(ri->clause, fpinfo))
+        {
+            fpinfo->remote_conds = lappend(fpinfo->remote_conds, ri);
+            add_filled_attrs(ri->clause, fpinfo);
+        }
+        else
+            fpinfo->local_conds = lappend(fpinfo->local_conds, ri);
+    }
+
+    pull_varattnos((Node *) baserel->reltarget->exprs, baserel->relid, &fpinfo->attrs_used);
+    foreach(lc, fpinfo->local_conds)
+    {
+        RestrictInfo *ri = lfirst_node(RestrictInfo, lc);
+
+        pull_varattnos((Node *) ri->clause, baserel->relid, &fpinfo->attrs_used);
+    }
+
+    tuples = baserel->tuples > 0 ? baserel->tuples : DEFAULT_SHEET_ROWS;
+    fpinfo->remote_rows = clamp_row_est(tuples * clauselist_selectivity(root, fpinfo->remote_conds,
+                                                                        baserel->relid, JOIN_INNER, NULL));
+    baserel->rows = clamp_row_est(tuples * clauselist_selectivity(root, baserel->baserestrictinfo,
+                                                                  baserel->relid, JOIN_INNER, NULL));
+}
+
+/*
+ * Sheet column and direction of each of 'pathkeys', or NIL if the ordering
+ * cannot be done by Google.  Google has no NULLS FIRST/LAST, so only
+ * columns pushed-down quals prove non-empty are sorted remotely; strings
+ * are left alone because their order depends on collation.
+ */
+static List *pushable_pathkeys(List *pathkeys, RelOptInfo *rel, GSheetsFdwRelationInfo *fpinfo)
+{
+    List *items = NIL;
+    ListCell *lc;
+
+    foreach(lc, pathkeys)
+    {
+        PathKey *pathkey = (PathKey *) lfirst(lc);
+        EquivalenceClass *ec = pathkey->pk_eclass;
+        Var *var = NULL;
+        ListCell *lc2;
+        bool desc;
+
+        if (ec->ec_has_volatile)
+            return NIL;
+
+        foreach(lc2, ec->ec_members)
+        {
+            EquivalenceMember *em = (EquivalenceMember *) lfirst(lc2);
+
+            if (bms_is_subset(em->em_relids, rel->relids) && !bms_is_empty(em->em_relids) &&
+                (var = foreign_var((Node *) em->em_expr, fpinfo)) != NULL)
+                break;
+            var = NULL;
+        }
+
+        if (var == NULL || !bms_is_member(var->varattno, fpinfo->filled_attrs))
+            return NIL;
+        if (gviz_class(var->vartype) != GVIZ_NUMBER &&
+            gviz_class(var->vartype) != GVIZ_DATE &&
+            gviz_class(var->vartype) != GVIZ_DATETIME)
+            return NIL;
+
+#if PG_VERSION_NUM >= 180000
+        desc = (pathkey->pk_cmptype == COMPARE_GT);
+#else
+        desc = (pathkey->pk_strategy == BTGreaterStrategyNumber);
+#endif
+        items = lappend(items, psprintf("%s %s", fpinfo->columns[var->varattno - 1],
+                                        desc ? "desc" : "asc"));
+    }
+
+    return items;
+}
+
+/*
+ * Row limit Google may apply to a scan of 'baserel' returning rows in the
+ * order of 'pathkeys', or 0.  That is only safe when the table is the whole
+ * query, every qual runs remotely and no local sort sits between the scan
+ * and the LIMIT.
+ */
+static int pushable_limit(PlannerInfo *root, RelOptInfo *baserel, GSheetsFdwRelationInfo *fpinfo,
+                          List *pathkeys)
+{
+    if (root->limit_tuples <= 0 || root->limit_tuples > INT_MAX)
+        return 0;
+    if (fpinfo->local_conds != NIL || bms_membership(root->all_baserels) != BMS_SINGLETON)
+        return 0;
+    if (root->query_pathkeys != NIL && pathkeys != root->query_pathkeys)
+        return 0;
+
+    return (int) root->limit_tuples;
+}
+
+static void gsheetsGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
+{
+    GSheetsFdwRelationInfo *fpinfo = (GSheetsFdwRelationInfo *) baserel->fdw_private;
+    Cost startup_cost = DEFAULT_STARTUP_COST;
+    Cost run_cost;
+    List *order_items;
+    int limit;
+
+    run_cost = fpinfo->remote_rows * (cpu_tuple_cost + DEFAULT_TRANSFER_COST) +
+        fpinfo->remote_rows * cpu_operator_cost * list_length(fpinfo->local_conds);
+
+    limit = pushable_limit(root, baserel, fpinfo, NIL);
+    add_path(baserel, (Path *) create_scan_path(root, baserel,
+                                                limit > 0 ? Min(baserel->rows, limit) : baserel->rows,
+                                                startup_cost, startup_cost + run_cost, NIL,
+                                                list_make2(makeInteger(limit), NIL)));
+
+    order_items = pushable_pathkeys(root->query_pathkeys, baserel, fpinfo);
+    if (order_items != NIL)
+    {
+        limit = pushable_limit(root, baserel, fpinfo, root->query_pathkeys);
+        add_path(baserel, (Path *) create_scan_path(root, baserel,
+                                                    limit > 0 ? Min(baserel->rows, limit) : baserel->rows,
+                                                    startup_cost, startup_cost + run_cost * 1.05,
+                                                    root->query_pathkeys,
+                                                    list_make2(makeInteger(limit), order_items)));
+    }
+}
+
+/* Query language form of a pushable aggregate, or NULL */
+static char *deparse_aggregate(Aggref *agg, GSheetsFdwRelationInfo *fpinfo, GvizClass *class)
+{
+    char *name;
+    Var *var;
+
+    if (agg->aggdistinct != NIL || agg->aggorder != NIL || agg->aggfilter != NULL ||
+        agg->aggkind != AGGKIND_NORMAL || agg->aggsplit != AGGSPLIT_SIMPLE || agg->aggvariadic)
+        return NULL;
+
+    if (get_func_namespace(agg->aggfnoid) != PG_CATALOG_NAMESPACE)
+        return NULL;
+    name = get_func_name(agg->aggfnoid);
+
+    if (agg->aggstar)
+    {
+        int attno;
+
+        /*
+         * The query language cannot count rows, count(*) becomes a count of
+         * a column the pushed-down quals prove filled.  NOT NULL is not
+         * enforced on the sheet, so it proves nothing here.
+         */
+        if (strcmp(name, "count") != 0 || (attno = bms_next_member(fpinfo->filled_attrs, -1)) < 0)
+            return NULL;
+        *class = GVIZ_NUMBER;
+        return psprintf("count(%s)", fpinfo->columns[attno - 1]);
+    }
+
+    if (list_length(agg->args) != 1 ||
+        (var = foreign_var((Node *) ((TargetEntry *) linitial(agg->args))->expr, fpinfo)) == NULL)
+        return NULL;
+
+    *class = gviz_class(var->vartype);
+    if (strcmp(name, "count") == 0)
+    {
+        /* Google would not count the empty cells of a string column */
+        if (*class == GVIZ_STRING)
+            return NULL;
+        *class = GVIZ_NUMBER;
+    }
+    else if (strcmp(name, "sum") == 0 || strcmp(name, "avg") == 0)
+    {
+        if (*class != GVIZ_NUMBER)
+            return NULL;
+    }
+    else if (strcmp(name, "min") == 0 || strcmp(name, "max") == 0)
+    {
+        if (*class != GVIZ_NUMBER && *class != GVIZ_DATE && *class != GVIZ_DATETIME)
+            return NULL;
+    }
+    else
+        return NULL;
+
+    return psprintf("%s(%s)", name, fpinfo->columns[var->varattno - 1]);
+}
+
+/*
+ * Push GROUP BY and aggregates down when the grouping columns are plain
+ * columns, the aggregates are ones the query language has and nothing but
+ * the aggregation sits between the scan and the grouped output. Aggregates
+ * without GROUP BY stay local: Google returns no row when nothing matches,
+ * where SQL wants a single row of count 0 and nulls.
+ */
+static void gsheetsGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+                                        RelOptInfo *input_rel, RelOptInfo *output_rel, void *extra)
+{
+    GSheetsFdwRelationInfo *ifpinfo = (GSheetsFdwRelationInfo *) input_rel->fdw_private;
+    GSheetsFdwRelationInfo *fpinfo;
+    GroupPathExtraData *gextra = (GroupPathExtraData *) extra;
+    Query *query = root->parse;
+    PathTarget *target = output_rel->reltarget;
+    List *group_exprs = NIL;
+    List *tlist = NIL;
+    ListCell *lc;
+    double rows;
+
+    if (stage != UPPERREL_GROUP_AGG || output_rel->fdw_private != NULL)
+        return;
+    if (ifpinfo == NULL || input_rel->reloptkind != RELOPT_BASEREL || ifpinfo->local_conds != NIL)
+        return;
+    if (query->groupClause == NIL || query->groupingSets != NIL || root->hasHavingQual ||
+        gextra->patype == PARTITIONWISE_AGGREGATE_PARTIAL)
+        return;
+
+    foreach(lc, query->groupClause)
+    {
+        SortGroupClause *sgc = (SortGroupClause *) lfirst(lc);
+        Var *var = foreign_var((Node *) get_sortgroupclause_expr(sgc, query->targetList), ifpinfo);
+
+        if (var == NULL)
+            return;
+        group_exprs = lappend(group_exprs, var);
+    }
+
+    foreach(lc, target->exprs)
+    {
+        Expr *expr = (Expr *) lfirst(lc);
+        GvizClass class;
+
+        if (IsA(expr, Var))
+        {
+            if (!list_member(group_exprs, expr))
+                return;
+        }
+        else if (!IsA(expr, Aggref) || deparse_aggregate((Aggref *) expr, ifpinfo, &class) == NULL)
+            return;
+
+        tlist = lappend(tlist, makeTargetEntry(expr, list_length(tlist) + 1, NULL, false));
+    }
+
+    rows = estimate_num_groups(root, group_exprs, ifpinfo->remote_rows, NULL, NULL);
+
+    fpinfo = (GSheetsFdwRelationInfo *) palloc(sizeof(GSheetsFdwRelationInfo));
+    memcpy(fpinfo, ifpinfo, sizeof(GSheetsFdwRelationInfo));
+    fpinfo->grouped = true;
+    fpinfo->group_exprs = group_exprs;
+    fpinfo->grouped_tlist = tlist;
+    output_rel->fdw_private = fpinfo;
+
+    add_path(output_rel, (Path *) create_upper_path(root, output_rel, target, rows,
+                                                    DEFAULT_STARTUP_COST,
+                                                    DEFAULT_STARTUP_COST + rows * (cpu_tuple_cost + DEFAULT_TRANSFER_COST),
+                                                    list_make2(makeInteger(0), NIL)));
+}
+
+/* Append "select ...", remembering the output format each column needs */
+static void append_select_item(StringInfo select, StringInfo format, const char *item, GvizClass class)
+{
+    const char *pattern = gviz_format(class);
+
+    appendStringInfoString(select, select->len == 0 ? "select " : ", ");
+    appendStringInfoString(select, item);
+
+    if (pattern != NULL)
+    {
+        appendStringInfoString(format, format->len == 0 ? " format " : ", ");
+        appendStringInfo(format, "%s '%s'", item, pattern);
+    }
+}
+
+/*
+ * Build the visualization query for a scan, and the list of slot positions
+ * its columns are stored in (0 for a column that is only a placeholder).
+ */
+static char *deparse_query(PlannerInfo *root, GSheetsFdwRelationInfo *fpinfo, Relation rel,
+                           List *order_items, int limit, List **positions)
+{
+    StringInfoData select;
+    StringInfoData format;
+    StringInfoData query;
+    ListCell *lc;
+
+    initStringInfo(&select);
+    initStringInfo(&format);
+    initStringInfo(&query);
+    *positions = NIL;
+
+    if (fpinfo->grouped)
+    {
+        foreach(lc, fpinfo->grouped_tlist)
+        {
+            TargetEntry *tle = lfirst_node(TargetEntry, lc);
+            GvizClass class;
+
+            if (IsA(tle->expr, Var))
+            {
+                Var *var = (Var *) tle->expr;
+
+                append_select_item(&select, &format, fpinfo->columns[var->varattno - 1],
+                                   gviz_class(var->vartype));
+            }
+            else
+            {
+                char *item = deparse_aggregate((Aggref *) tle->expr, fpinfo, &class);
+
+                append_select_item(&select, &format, item, class);
+            }
+            *positions = lappend_int(*positions, tle->resno);
+        }
+    }
+    else
+    {
+        TupleDesc tupdesc = RelationGetDescr(rel);
+        bool whole_row = bms_is_member(0 - FirstLowInvalidHeapAttributeNumber, fpinfo->attrs_used);
+
+        for (int i = 0; i < tupdesc->natts; i++)
+        {
+            Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+
+            if (att->attisdropped)
+                continue;
+            if (whole_row ||
+                bms_is_member(att->attnum - FirstLowInvalidHeapAttributeNumber, fpinfo->attrs_used))
+            {
+                append_select_item(&select, &format, fpinfo->columns[i], gviz_class(att->atttypid));
+                *positions = lappend_int(*positions, att->attnum);
+            }
+        }
+
+        /* Something has to be selected, e.g. for count(*) computed locally */
+        if (*positions == NIL)
+        {
+            append_select_item(&select, &format, fpinfo->columns[0], GVIZ_NONE);
+            *positions = lappend_int(*positions, 0);
+        }
+    }
+
+    appendStringInfoString(&query, select.data);
+
+    foreach(lc, fpinfo->remote_conds)
+    {
+        RestrictInfo *ri = lfirst_node(RestrictInfo, lc);
+
+        appendStringInfoString(&query, lc == list_head(fpinfo->remote_conds) ? " where " : " and ");
+        deparse_expr((Node *) ri->clause, fpinfo, &query);
+    }
+
+    foreach(lc, fpinfo->group_exprs)
+    {
+        Var *var = (Var *) lfirst(lc);
+
+        appendStringInfoString(&query, lc == list_head(fpinfo->group_exprs) ? " group by " : ", ");
+        appendStringInfoString(&query, fpinfo->columns[var->varattno - 1]);
+    }
+
+    foreach(lc, order_items)
+    {
+        appendStringInfoString(&query, lc == list_head(order_items) ? " order by " : ", ");
+        appendStringInfoString(&query, (char *) lfirst(lc));
+    }
+
+    if (limit > 0)
+        appendStringInfo(&query, " limit %d", limit);
+
+    appendStringInfoString(&query, format.data);
+
+    return query.data;
+}
+
+static ForeignScan *gsheetsGetForeignPlan(PlannerInfo *root, RelOptInfo *foreignrel, Oid foreigntableid,
+                                          ForeignPath *best_path, List *tlist, List *scan_clauses,
+                                          Plan *outer_plan)
+{
+    GSheetsFdwRelationInfo *fpinfo = (GSheetsFdwRelationInfo *) foreignrel->fdw_private;
+    int limit = intVal(linitial(best_path->fdw_private));
+    List *order_items = (List *) lsecond(best_path->fdw_private);
+    List *local_exprs = NIL;
+    List *fdw_scan_tlist = NIL;
+    List *positions;
+    List *cells = NIL;
+    Index scan_relid;
+    Relation rel = NULL;
+    char *query;
+    ListCell *lc;
+
+    if (IS_SIMPLE_REL(foreignrel))
+    {
+        scan_relid = foreignrel->relid;
+
+        foreach(lc, scan_clauses)
+        {
+            RestrictInfo *ri = lfirst_node(RestrictInfo, lc);
+
+            /* Pseudoconstants are checked by a gating Result node */
+            if (ri->pseudoconstant || list_member_ptr(fpinfo->remote_conds, ri))
+                continue;
+            local_exprs = lappend(local_exprs, ri->clause);
+        }
+
+        rel = table_open(foreigntableid, NoLock);
+    }
+    else
+    {
+        /* Aggregation: the scan returns the grouped target list */
+        scan_relid = 0;
+        fdw_scan_tlist = fpinfo->grouped_tlist;
+    }
+
+    query = deparse_query(root, fpinfo, rel, order_items, limit, &positions);
+
+    /*
+     * With nothing for Google to evaluate the cells are read as they are:
+     * the visualization query gives each column the type of most of its
+     * cells and returns the other cells empty.
+     */
+    if (!fpinfo->grouped && fpinfo->remote_conds == NIL && order_items == NIL && limit <= 0)
+    {
+        foreach(lc, positions)
+        {
+            int pos = lfirst_int(lc);
+
+            cells = lappend_int(cells, pos == 0 ? 0 : column_index(fpinfo->columns[pos - 1]));
+        }
+    }
+
+    if (rel != NULL)
+        table_close(rel, NoLock);
+
+    return make_foreignscan(tlist,
+                            local_exprs,
+                            scan_relid,
+                            NIL,
+                            lappend(list_make5(makeString(fpinfo->spreadsheet_id),
+                                               makeString(pstrdup(fpinfo->sheet_name)),
+                                               makeInteger(fpinfo->header),
+                                               makeString(query),
+                                               positions),
+                                    cells),
+                            fdw_scan_tlist,
+                            NIL,
+                            outer_plan);
+}
+
+static void gsheets_fdw_row(char **fields, int nfields, void *arg)
+{
+    GSheetsFdwScanState *state = (GSheetsFdwScanState *) arg;
+    MemoryContext oldcontext;
+
+    /* The first row holds the column labels */
+    if (state->skip_row)
+    {
+        state->skip_row = false;
+        return;
+    }
+
+    oldcontext = MemoryContextSwitchTo(state->row_mcxt);
+
+    memset(state->nulls, true, state->tupdesc->natts * sizeof(bool));
+    for (int i = 0; i < nfields && i < state->npositions; i++)
+    {
+        int pos = state->positions[i];
+        Form_pg_attribute att;
+
+        if (pos == 0)
+            continue;
+
+        att = TupleDescAttr(state->tupdesc, pos - 1);
+        /* Empty cells of string columns are '', as read_sheet returns them */
+        if (fields[i][0] == '\0' && gviz_class(att->atttypid) != GVIZ_STRING)
+            continue;
+
+        state->values[pos - 1] = InputFunctionCall(&state->in_funcs[pos - 1], fields[i],
+                                                   state->typioparams[pos - 1], att->atttypmod);
+        state->nulls[pos - 1] = false;
+    }
+
+    tuplestore_putvalues(state->tupstore, state->tupdesc, state->values, state->nulls);
+    TRACE_GSHEETS_TUPLE_EMIT(tuplestore_tuple_count(state->tupstore));
+
+    MemoryContextSwitchTo(oldcontext);
+    MemoryContextReset(state->row_mcxt);
+}
+
+/* Read the whole sheet through the values API into the scan's tuplestore */
+static void gsheets_fdw_fetch_values(GSheetsFdwScanState *state, struct curl_slist *headers)
+{
+    JsonbValue *rows = fetch_values(state->spreadsheet_id,
+                                    url_encode(quote_sheet_name(state->sheet_name)), headers);
+    int nrows = rows != NULL ? JsonContainerSize(rows->val.binary.data) : 0;
+
+    for (int r = state->header ? 1 : 0; r < nrows; r++)
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(state->row_mcxt);
+
+        memset(state->nulls, true, state->tupdesc->natts * sizeof(bool));
+        for (int i = 0; i < state->npositions; i++)
+        {
+            int pos = state->positions[i];
+            Form_pg_attribute att;
+
+            if (pos == 0)
+                continue;
+
+            att = TupleDescAttr(state->tupdesc, pos - 1);
+            state->values[pos - 1] = value_datum(sheet_cell(rows, r, state->cells[i]), att->atttypid,
+                                                 &state->in_funcs[pos - 1], state->typioparams[pos - 1],
+                                                 att->atttypmod, gviz_class(att->atttypid) == GVIZ_STRING,
+                                                 &state->nulls[pos - 1]);
+        }
+
+        tuplestore_putvalues(state->tupstore, state->tupdesc, state->values, state->nulls);
+        TRACE_GSHEETS_TUPLE_EMIT(tuplestore_tuple_count(state->tupstore));
+
+        MemoryContextSwitchTo(oldcontext);
+        MemoryContextReset(state->row_mcxt);
+    }
+}
+
+/* Run the query and collect its result in the scan's tuplestore */
+static void gsheets_fdw_fetch(GSheetsFdwScanState *state)
+{
+    struct curl_slist *headers = auth_headers();
+
+    if (state->cells != NULL)
+        gsheets_fdw_fetch_values(state, headers);
+    else
+    {
+        CsvParser parser;
+        char *params[] = {
+            "tqx=out:csv",
+            psprintf("sheet=%s", url_encode(state->sheet_name)),
+            state->header ? "headers=1" : "headers=0",
+            psprintf("tq=%s", url_encode(state->query))
+        };
+
+        state->skip_row = true;
+        csv_parser_init(&parser, gsheets_fdw_row, state);
+        http_get_stream(GVIZ_URL(state->spreadsheet_id), params, 4, headers, csv_feed, &parser);
+        csv_parser_finish(&parser);
+    }
+
+    curl_slist_free_all(headers);
+    state->fetched = true;
+}
+
+static void gsheetsBeginForeignScan(ForeignScanState *node, int eflags)
+{
+    ForeignScan *plan = (ForeignScan *) node->ss.ps.plan;
+    GSheetsFdwScanState *state;
+    List *positions;
+    List *cells;
+    ListCell *lc;
+    int i;
+
+    if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+        return;
+
+    state = (GSheetsFdwScanState *) palloc0(sizeof(GSheetsFdwScanState));
+    node->fdw_state = state;
+
+    state->spreadsheet_id = strVal(list_nth(plan->fdw_private, 0));
+    state->sheet_name = strVal(list_nth(plan->fdw_private, 1));
+    state->header = intVal(list_nth(plan->fdw_private, 2)) != 0;
+    state->query = strVal(list_nth(plan->fdw_private, 3));
+    positions = (List *) list_nth(plan->fdw_private, 4);
+    cells = (List *) list_nth(plan->fdw_private, 5);
+
+    state->tupdesc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+    state->npositions = list_length(positions);
+    state->positions = (int *) palloc(state->npositions * sizeof(int));
+    i = 0;
+    foreach(lc, positions)
+        state->positions[i++] = lfirst_int(lc);
+    if (cells != NIL)
+    {
+        state->cells = (int *) palloc(state->npositions * sizeof(int));
+        i = 0;
+        foreach(lc, cells)
+            state->cells[i++] = lfirst_int(lc);
+    }
+
+    state->in_funcs = (FmgrInfo *) palloc0(state->tupdesc->natts * sizeof(FmgrInfo));
+    state->typioparams = (Oid *) palloc0(state->tupdesc->natts * sizeof(Oid));
+    state->values = (Datum *) palloc0(state->tupdesc->natts * sizeof(Datum));
+    state->nulls = (bool *) palloc(state->tupdesc->natts * sizeof(bool));
+    for (i = 0; i < state->npositions; i++)
+    {
+        int pos = state->positions[i];
+        Oid func;
+
+        if (pos == 0)
+            continue;
+        getTypeInputInfo(TupleDescAttr(state->tupdesc, pos - 1)->atttypid, &func,
+                         &state->typioparams[pos - 1]);
+        fmgr_info(func, &state->in_funcs[pos - 1]);
+    }
+
+    state->tupstore = tuplestore_begin_heap(true, false, work_mem);
+    state->fetch_slot = MakeSingleTupleTableSlot(state->tupdesc, &TTSOpsMinimalTuple);
+    state->row_mcxt = AllocSetContextCreate(CurrentMemoryContext,
+                                            "gsheets_fdw row",
+                                            ALLOCSET_DEFAULT_SIZES);
+}
+
+static TupleTableSlot *gsheetsIterateForeignScan(ForeignScanState *node)
+{
+    GSheetsFdwScanState *state = (GSheetsFdwScanState *) node->fdw_state;
+    TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+
+    if (!state->fetched)
+        gsheets_fdw_fetch(state);
+
+    if (tuplestore_gettupleslot(state->tupstore, true, false, state->fetch_slot))
+        ExecCopySlot(slot, state->fetch_slot);
+    else
+        ExecClearTuple(slot);
+
+    return slot;
+}
+
+static void gsheetsReScanForeignScan(ForeignScanState *node)
+{
+    GSheetsFdwScanState *state = (GSheetsFdwScanState *) node->fdw_state;
+
+    if (state->fetched)
+        tuplestore_rescan(state->tupstore);
+}
+
+static void gsheetsEndForeignScan(ForeignScanState *node)
+{
+    GSheetsFdwScanState *state = (GSheetsFdwScanState *) node->fdw_state;
+
+    if (state == NULL)
+        return;
+
+    ExecDropSingleTupleTableSlot(state->fetch_slot);
+    tuplestore_end(state->tupstore);
+    MemoryContextDelete(state->row_mcxt);
+}
+
+static void gsheetsExplainForeignScan(ForeignScanState *node, ExplainState *es)
+{
+    ForeignScan *plan = (ForeignScan *) node->ss.ps.plan;
+
+    if (list_nth(plan->fdw_private, 5) != NIL)
+        ExplainPropertyText("Sheet Range", quote_sheet_name(strVal(list_nth(plan->fdw_private, 1))), es);
+    else
+        ExplainPropertyText("Sheet Query", strVal(list_nth(plan->fdw_private, 3)), es);
+}
+
+/* Fields of a metadata request that returns the first rows of some tabs */
+#define IMPORT_FIELDS "sheets(properties(title,gridProperties(rowCount,columnCount)),data/rowData/values(formattedValue,effectiveValue,userEnteredFormat/numberFormat))"
+
+static JsonbValue *json_field(JsonbContainer *container, const char *key)
+{
+    return getKeyJsonValueFromContainer(container, key, strlen(key), NULL);
+}
+
+/*
+ * "ranges" parameter selecting the first 'nrows' rows of a tab, cut to its
+ * grid when the grid size is known.
+ */
+static char *tab_range(sheet_tab *tab, int nrows)
+{
+    char *title = quote_sheet_name(tab->title);
+
+    if (tab->nrows > 0 && tab->ncols > 0)
+        return psprintf("ranges=%s", url_encode(psprintf("%s!A1:%s%d", title, column_letter(tab->ncols - 1),
+                                                         Min(nrows, tab->nrows))));
+    return psprintf("ranges=%s", url_encode(psprintf("%s!1:%d", title, nrows)));
+}
+
+/* Cells of the i-th sampled row of a tab, or NULL */
+static JsonbContainer *row_cells(JsonbValue *rows, int i)
+{
+    JsonbValue *row = getIthJsonbValueFromContainer(rows->val.binary.data, i);
+    JsonbValue *cells;
+
+    if (row == NULL || row->type != jbvBinary)
+        return NULL;
+    cells = json_field(row->val.binary.data, "values");
+    if (cells == NULL || cells->type != jbvBinary)
+        return NULL;
+    return cells->val.binary.data;
+}
+
+/*
+ * CREATE FOREIGN TABLE command for a tab whose properties and first rows are
+ * in 'sheet'.  Column names come from the header row, types are inferred
+ * from the rows below it, and are stored in the schema cache for read_sheet.
+ */
+static char *import_tab(JsonbContainer *sheet, const char *id, const char *server, bool header)
+{
+    JsonbValue *props = json_field(sheet, "properties");
+    JsonbValue *title;
+    JsonbValue *size;
+    JsonbValue *data;
+    JsonbValue *grid;
+    JsonbValue *rows = NULL;
+    JsonbValue *count;
+    int nrows = 0;
+    int ncols = 0;
+    int grid_cols = 0;
+    List *names = NIL;
+    List *types = NIL;
+    Oid *col_types;
+    char **col_names;
+    char *sheet_name;
+    StringInfoData cmd;
+
+    if (props == NULL || props->type != jbvBinary ||
+        (title = json_field(props->val.binary.data, "title")) == NULL || title->type != jbvString)
+        return NULL;
+    sheet_name = pnstrdup(title->val.string.val, title->val.string.len);
+
+    size = json_field(props->val.binary.data, "gridProperties");
+    if (size != NULL && size->type == jbvBinary &&
+        (count = json_field(size->val.binary.data, "columnCount")) != NULL && count->type == jbvNumeric)
+        grid_cols = DatumGetInt32(DirectFunctionCall1(numeric_int4, NumericGetDatum(count->val.numeric)));
+
+    data = json_field(sheet, "data");
+    if (data != NULL && data->type == jbvBinary &&
+        (grid = getIthJsonbValueFromContainer(data->val.binary.data, 0)) != NULL &&
+        grid->type == jbvBinary &&
+        (rows = json_field(grid->val.binary.data, "rowData")) != NULL && rows->type == jbvBinary)
+        nrows = JsonContainerSize(rows->val.binary.data);
+
+    /* The header row decides the width, otherwise the widest sampled row */
+    for (int r = 0; r < nrows; r++)
+    {
+        JsonbContainer *cells = row_cells(rows, r);
+        int width = cells ? JsonContainerSize(cells) : 0;
+
+        if (header && r == 0)
+        {
+            ncols = width;
+            break;
+        }
+        ncols = Max(ncols, width);
+    }
+    if (grid_cols > 0)
+        ncols = Min(ncols, grid_cols);
+
+    col_types = (Oid *) palloc0(Max(ncols, 1) * sizeof(Oid));
+    col_names = (char **) palloc0(Max(ncols, 1) * sizeof(char *));
+
+    for (int r = 0; r < nrows; r++)
+    {
+        JsonbContainer *cells = row_cells(rows, r);
+
+        if (cells == NULL)
+            continue;
+
+        for (int c = 0; c < ncols && c < JsonContainerSize(cells); c++)
+        {
+            JsonbValue *cell = getIthJsonbValueFromContainer(cells, c);
+
+            if (header && r == 0)
+            {
+                JsonbValue *value = (cell && cell->type == jbvBinary) ?
+                    json_field(cell->val.binary.data, "formattedValue") : NULL;
+
+                if (value != NULL && value->type == jbvString)
+                    col_names[c] = pnstrdup(value->val.string.val, value->val.string.len);
+            }
+            else
+                col_types[c] = widen_type(col_types[c], cell_type(cell));
+        }
+    }
+
+    for (int c = 0; c < ncols; c++)
+    {
+        if (header)
+            names = lappend(names, col_names[c] ? col_names[c] : "");
+        if (col_types[c] == InvalidOid)
+            col_types[c] = TEXTOID;
+        types = lappend_oid(types, col_types[c]);
+    }
+    store_schema(id, sheet_name, schema_revision(names, ncols), names, types);
+
+    initStringInfo(&cmd);
+    appendStringInfo(&cmd, "CREATE FOREIGN TABLE %s (", quote_identifier(sheet_name));
+    for (int c = 0; c < ncols; c++)
+    {
+        char *base = col_names[c];
+        char *name;
+
+        /*
+         * Unnamed columns are named after their letter, duplicates get a
+         * suffix.  Names are compared as the identifiers they will be, cut
+         * to NAMEDATALEN - 1 bytes.
+         */
+        if (base == NULL || *base == '\0')
+        {
+            base = column_letter(c);
+            for (char *p = base; *p; p++)
+                *p = pg_ascii_tolower(*p);
+        }
+        name = pnstrdup(base, pg_mbcliplen(base, strlen(base), NAMEDATALEN - 1));
+        for (int n = 2, i = 0; i < c; i++)
+        {
+            if (strcmp(name, col_names[i]) == 0)
+            {
+                char *suffix = psprintf("_%d", n++);
+
+                name = psprintf("%.*s%s", pg_mbcliplen(base, strlen(base), NAMEDATALEN - 1 - strlen(suffix)),
+                                base, suffix);
+                i = -1;
+            }
+        }
+        col_names[c] = name;
+
+        appendStringInfo(&cmd, "%s%s %s", c > 0 ? ", " : "",
+                         quote_identifier(name), format_type_be(col_types[c]));
+    }
+    appendStringInfo(&cmd, ") SERVER %s OPTIONS (spreadsheet %s, sheet_name %s, header %s)",
+                     quote_identifier(server), quote_literal_cstr(id),
+                     quote_literal_cstr(sheet_name), header ? "'true'" : "'false'");
+
+    return cmd.data;
+}
+
+/*
+ * IMPORT FOREIGN SCHEMA "<spreadsheet id or URL>" creates a foreign table
+ * per tab.  All tabs are sampled with a single metadata request; only when
+ * the tabs are not named with LIMIT TO is another one needed to list them.
+ *
+ * Option: header (default true), whether the first row holds column names.
+ */
+static List *gsheetsImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid)
+{
+    ForeignServer *server = GetForeignServer(serverOid);
+    char *id = sheet_id_from_link(stmt->remote_schema);
+    struct curl_slist *headers = auth_headers();
+    bool header = true;
+    List *tabs = NIL;
+    List *commands = NIL;
+    char **params;
+    int nparams = 0;
+    Jsonb *jsonb;
+    JsonbValue *sheets;
+    ListCell *lc;
+
+    foreach(lc, stmt->options)
+    {
+        DefElem *def = (DefElem *) lfirst(lc);
+
+        if (strcmp(def->defname, "header") == 0)
+            header = defGetBoolean(def);
+        else
+            ereport(ERROR,
+                    (errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+                     errmsg("Invalid option \"%s\"", def->defname)));
+    }
+
+    /* Named tabs are sampled without knowing their grid size */
+    if (stmt->list_type == FDW_IMPORT_SCHEMA_LIMIT_TO)
+    {
+        foreach(lc, stmt->table_list)
+        {
+            sheet_tab *tab = (sheet_tab *) palloc0(sizeof(sheet_tab));
+
+            tab->title = ((RangeVar *) lfirst(lc))->relname;
+            tabs = lappend(tabs, tab);
+        }
+    }
+    else
+    {
+        foreach(lc, sheet_tabs(id, headers))
+        {
+            sheet_tab *tab = (sheet_tab *) lfirst(lc);
+            bool excluded = false;
+            ListCell *lc2;
+
+            if (stmt->list_type == FDW_IMPORT_SCHEMA_EXCEPT)
+                foreach(lc2, stmt->table_list)
+                    if (strcmp(((RangeVar *) lfirst(lc2))->relname, tab->title) == 0)
+                        excluded = true;
+            if (!excluded)
+                tabs = lappend(tabs, tab);
+        }
+    }
+
+    if (tabs == NIL)
+    {
+        curl_slist_free_all(headers);
+        return NIL;
+    }
+
+    params = (char **) palloc((list_length(tabs) + 1) * sizeof(char *));
+    params[nparams++] = psprintf("fields=%s", url_encode(IMPORT_FIELDS));
+    foreach(lc, tabs)
+        params[nparams++] = tab_range((sheet_tab *) lfirst(lc), infer_sample_rows + (header ? 1 : 0));
+
+    jsonb = fetch_metadata(id, params, nparams, headers);
+    curl_slist_free_all(headers);
+
+    if (JB_ROOT_IS_OBJECT(jsonb) &&
+        (sheets = json_field(&jsonb->root, "sheets")) != NULL && sheets->type == jbvBinary)
+    {
+        for (int i = 0; i < JsonContainerSize(sheets->val.binary.data); i++)
+        {
+            JsonbValue *sheet = getIthJsonbValueFromContainer(sheets->val.binary.data, i);
+            char *cmd;
+
+            if (sheet == NULL || sheet->type != jbvBinary)
+                continue;
+            cmd = import_tab(sheet->val.binary.data, id, server->servername, header);
+            if (cmd != NULL)
+                commands = lappend(commands, cmd);
+        }
+    }
+
+    return commands;
+}
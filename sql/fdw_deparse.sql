@@ -0,0 +1,61 @@
+CREATE EXTENSION gsheets;
+CREATE SERVER sheets FOREIGN DATA WRAPPER gsheets_fdw;
+CREATE FOREIGN TABLE person (
+    name text,
+    code varchar(10),
+    age int,
+    born date,
+    seen timestamp,
+    active boolean,
+    team text NOT NULL
+) SERVER sheets OPTIONS (spreadsheet '1BxiMVs0XRA5nFMdKvBdBZjgmUUqptlbs74OgvE2upms', sheet_name 'People');
+-- Visualization query, or range read as is, of a statement's foreign scan; planning needs no network
+CREATE FUNCTION sheet_query(query text) RETURNS SETOF text
+LANGUAGE plpgsql AS $$
+DECLARE
+    line text;
+BEGIN
+    FOR line IN EXECUTE 'EXPLAIN (VERBOSE, COSTS OFF) ' || query LOOP
+        IF line ~ 'Sheet (Query|Range): ' THEN
+            RETURN NEXT regexp_replace(line, '^.*Sheet (Query|Range): ', '');
+        END IF;
+    END LOOP;
+END
+$$;
+-- Filters Google evaluates
+SELECT q AS query, sheet_query(q) FROM (VALUES
+    ($$SELECT name FROM person WHERE age > 30$$),
+    ($$SELECT name FROM person WHERE age <> 30$$),
+    ($$SELECT name FROM person WHERE age IS NULL$$),
+    ($$SELECT name FROM person WHERE born >= date '2024-01-01'$$),
+    ($$SELECT name FROM person WHERE seen < timestamp '2024-01-01 10:00'$$),
+    ($$SELECT name FROM person WHERE name = 'Ann'$$),
+    ($$SELECT name FROM person WHERE code = 'X1'$$),
+    ($$SELECT name FROM person WHERE name LIKE 'A%'$$)
+) AS queries(q);
+-- Empty string cells are '' locally but null to Google, these filters stay local
+-- and with nothing pushed down the cells are read as they are
+SELECT q AS query, sheet_query(q) FROM (VALUES
+    ($$SELECT name FROM person WHERE name = ''$$),
+    ($$SELECT name FROM person WHERE name <> 'Ann'$$),
+    ($$SELECT name FROM person WHERE name IS NOT NULL$$),
+    ($$SELECT name FROM person WHERE code IS NULL$$),
+    ($$SELECT name FROM person WHERE name LIKE '%%'$$)
+) AS queries(q);
+-- count(*) needs a column the filters prove filled, NOT NULL is not enforced
+SELECT q AS query, sheet_query(q) FROM (VALUES
+    ($$SELECT team, count(*) FROM person GROUP BY team$$),
+    ($$SELECT team, count(*) FROM person WHERE age > 30 GROUP BY team$$),
+    ($$SELECT team, count(name) FROM person GROUP BY team$$),
+    ($$SELECT team, count(age) FROM person GROUP BY team$$)
+) AS queries(q);
+-- Without GROUP BY an empty match still yields a row, so aggregates stay local
+SELECT q AS query, sheet_query(q) FROM (VALUES
+    ($$SELECT count(*) FROM person$$),
+    ($$SELECT count(*) FROM person WHERE age > 30$$),
+    ($$SELECT max(age) FROM person WHERE age > 30$$)
+) AS queries(q);
+DROP FUNCTION sheet_query(text);
+DROP FOREIGN TABLE person;
+DROP SERVER sheets;
+DROP EXTENSION gsheets;
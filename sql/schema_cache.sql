@@ -0,0 +1,20 @@
+CREATE EXTENSION gsheets;
+\set VERBOSITY terse
+CREATE ROLE regress_gsheets_user;
+SET ROLE regress_gsheets_user;
+-- Inferred schemas are only reachable through the extension's functions
+SELECT * FROM gsheets_schema_cache;
+INSERT INTO gsheets_schema_cache VALUES ('id', 'Sheet1', 'r1', NULL, '{integer}', now());
+SELECT gsheets_store_schema('id', 'Sheet1', 'r1', '{a,b}', '{bigint,text}');
+SELECT gsheets_lookup_schema('id', 'Sheet1', 'r1');
+-- Only types inference produces are stored
+SELECT gsheets_store_schema('id', 'Sheet1', 'r1', '{a}', '{integer}');
+SELECT gsheets_store_schema('id', 'Sheet1', 'r1', '{a}', NULL);
+-- Storing the same revision again updates it, a new revision replaces older ones
+SELECT gsheets_store_schema('id', 'Sheet1', 'r1', '{a,b}', '{numeric,date}');
+SELECT gsheets_lookup_schema('id', 'Sheet1', 'r1');
+SELECT gsheets_store_schema('id', 'Sheet1', 'r2', '{a,b}', '{timestamp,time}');
+SELECT gsheets_lookup_schema('id', 'Sheet1', 'r1') AS r1, gsheets_lookup_schema('id', 'Sheet1', 'r2') AS r2;
+RESET ROLE;
+DROP ROLE regress_gsheets_user;
+DROP EXTENSION gsheets;
@@ -0,0 +1,55 @@
+CREATE EXTENSION gsheets;
+SET datestyle = 'ISO, YMD';
+SET timezone = 'UTC';
+-- Type inferred from a cell's value and number format
+\pset null '(null)'
+SELECT kind, gsheets_cell_type(cell) AS type FROM (VALUES
+    ('integer', '{"effectiveValue": {"numberValue": 42}}'::jsonb),
+    ('decimal', '{"effectiveValue": {"numberValue": 42.5}}'::jsonb),
+    ('long integer', '{"effectiveValue": {"numberValue": 12345678901234567890}}'::jsonb),
+    ('date', '{"effectiveValue": {"numberValue": 45292}, "userEnteredFormat": {"numberFormat": {"type": "DATE"}}}'::jsonb),
+    ('date and time', '{"effectiveValue": {"numberValue": 45292.5}, "userEnteredFormat": {"numberFormat": {"type": "DATE_TIME"}}}'::jsonb),
+    ('time', '{"effectiveValue": {"numberValue": 0.5}, "userEnteredFormat": {"numberFormat": {"type": "TIME"}}}'::jsonb),
+    ('percent', '{"effectiveValue": {"numberValue": 0.5}, "userEnteredFormat": {"numberFormat": {"type": "PERCENT"}}}'::jsonb),
+    ('boolean', '{"effectiveValue": {"boolValue": true}}'::jsonb),
+    ('string', '{"effectiveValue": {"stringValue": "42"}}'::jsonb),
+    ('empty', '{}'::jsonb)
+) AS cells(kind, cell);
+-- Values read_sheet builds from unformatted cells, dates and times are serials
+SELECT value, type, quote_nullable(gsheets_cell_value(value, type)) AS result FROM (VALUES
+    ('42'::jsonb, 'bigint'::regtype),
+    ('12.50'::jsonb, 'numeric'::regtype),
+    ('true'::jsonb, 'boolean'::regtype),
+    ('45292'::jsonb, 'date'::regtype),
+    ('45292.75'::jsonb, 'timestamp'::regtype),
+    ('0.25'::jsonb, 'time'::regtype),
+    ('45292.5'::jsonb, 'text'::regtype),
+    ('"abc"'::jsonb, 'text'::regtype),
+    ('""'::jsonb, 'text'::regtype),
+    ('""'::jsonb, 'bigint'::regtype),
+    ('null'::jsonb, 'date'::regtype),
+    ('"2024-01-01"'::jsonb, 'date'::regtype)
+) AS cells(value, type);
+SELECT gsheets_cell_value('[1]', 'bigint');
+SELECT gsheets_cell_value('1', 'integer');
+-- Cells typed writes send; what a double cannot hold stays text
+SELECT '42::bigint' AS value, gsheets_typed_cell(42::bigint) AS cell
+UNION ALL SELECT '9007199254740993::bigint', gsheets_typed_cell(9007199254740993::bigint)
+UNION ALL SELECT '0.1::numeric', gsheets_typed_cell(0.1::numeric)
+UNION ALL SELECT '123456789012.3456789::numeric', gsheets_typed_cell(123456789012.3456789::numeric)
+UNION ALL SELECT '1e20::numeric', gsheets_typed_cell(1e20::numeric)
+UNION ALL SELECT '''NaN''::numeric', gsheets_typed_cell('NaN'::numeric)
+UNION ALL SELECT '1.5::float8', gsheets_typed_cell(1.5::float8)
+UNION ALL SELECT 'true', gsheets_typed_cell(true)
+UNION ALL SELECT 'date ''2024-01-01''', gsheets_typed_cell(date '2024-01-01')
+UNION ALL SELECT 'date ''infinity''', gsheets_typed_cell(date 'infinity')
+UNION ALL SELECT 'timestamp ''2024-01-01 12:00''', gsheets_typed_cell(timestamp '2024-01-01 12:00')
+UNION ALL SELECT 'timestamptz ''2024-01-01 14:00+02''', gsheets_typed_cell(timestamptz '2024-01-01 14:00+02')
+UNION ALL SELECT 'time ''06:00''', gsheets_typed_cell(time '06:00')
+UNION ALL SELECT '''=1+1''::text', gsheets_typed_cell('=1+1'::text);
+-- Typed timestamps and times read back with their fractional seconds
+SELECT gsheets_cell_value(gsheets_typed_cell(timestamp '2024-01-01 12:34:56.789') #> '{userEnteredValue,numberValue}', 'timestamp') AS value
+UNION ALL SELECT gsheets_cell_value(gsheets_typed_cell(timestamp '1999-12-31 23:59:59.999') #> '{userEnteredValue,numberValue}', 'timestamp')
+UNION ALL SELECT gsheets_cell_value(gsheets_typed_cell(time '23:59:59.999') #> '{userEnteredValue,numberValue}', 'time')
+UNION ALL SELECT gsheets_cell_value(gsheets_typed_cell(time '00:00:00.001') #> '{userEnteredValue,numberValue}', 'time');
+DROP EXTENSION gsheets;
@@ -0,0 +1,198 @@
+#include "postgres.h"
+#include "csv_parser.h"
+
+/*
+ * Streaming RFC 4180 parser.  Runs of ordinary bytes are located eight bytes
+ * at a time: each word is tested for the bytes that can end a run (SWAR),
+ * and only words that contain one are examined byte by byte.
+ */
+
+#define ONES UINT64CONST(0x0101010101010101)
+#define HIGHS UINT64CONST(0x8080808080808080)
+
+/* Nonzero if any byte of 'word' equals 'c' */
+static inline uint64 has_byte(uint64 word, unsigned char c)
+{
+    uint64 x = word ^ (ONES * c);
+
+    return (x - ONES) & ~x & HIGHS;
+}
+
+/* First byte in [cur, end) that may end an unquoted run */
+static const char *find_special(const char *cur, const char *end)
+{
+    while (end - cur >= 8)
+    {
+        uint64 word;
+
+        memcpy(&word, cur, 8);
+        if (has_byte(word, ',') | has_byte(word, '"') |
+            has_byte(word, '\n') | has_byte(word, '\r'))
+            break;
+        cur += 8;
+    }
+
+    while (cur < end && *cur != ',' && *cur != '"' && *cur != '\n' && *cur != '\r')
+        cur++;
+
+    return cur;
+}
+
+/* First quote in [cur, end) */
+static const char *find_quote(const char *cur, const char *end)
+{
+    while (end - cur >= 8)
+    {
+        uint64 word;
+
+        memcpy(&word, cur, 8);
+        if (has_byte(word, '"'))
+            break;
+        cur += 8;
+    }
+
+    while (cur < end && *cur != '"')
+        cur++;
+
+    return cur;
+}
+
+void csv_parser_init(CsvParser *parser, csv_row_callback callback, void *arg)
+{
+    parser->state = CSV_UNQUOTED;
+    initStringInfo(&parser->row);
+    parser->field_start = 0;
+    parser->maxfields = 32;
+    parser->offsets = (int *) palloc(parser->maxfields * sizeof(int));
+    parser->fields = (char **) palloc(parser->maxfields * sizeof(char *));
+    parser->nfields = 0;
+    parser->row_started = false;
+    parser->skip_lf = false;
+    parser->callback = callback;
+    parser->arg = arg;
+}
+
+static void end_field(CsvParser *parser)
+{
+    if (parser->nfields == parser->maxfields)
+    {
+        parser->maxfields *= 2;
+        parser->offsets = (int *) repalloc(parser->offsets, parser->maxfields * sizeof(int));
+        parser->fields = (char **) repalloc(parser->fields, parser->maxfields * sizeof(char *));
+    }
+
+    appendStringInfoChar(&parser->row, '\0');
+    parser->offsets[parser->nfields++] = parser->field_start;
+    parser->field_start = parser->row.len;
+}
+
+static void end_row(CsvParser *parser)
+{
+    end_field(parser);
+
+    /* Offsets are resolved only now, row.data may have moved while growing */
+    for (int i = 0; i < parser->nfields; i++)
+        parser->fields[i] = parser->row.data + parser->offsets[i];
+
+    parser->callback(parser->fields, parser->nfields, parser->arg);
+
+    resetStringInfo(&parser->row);
+    parser->field_start = 0;
+    parser->nfields = 0;
+    parser->row_started = false;
+}
+
+void csv_parser_feed(CsvParser *parser, const char *data, size_t len)
+{
+    const char *cur = data;
+    const char *end = data + len;
+
+    while (cur < end)
+    {
+        const char *next;
+
+        switch (parser->state)
+        {
+            case CSV_UNQUOTED:
+                if (parser->skip_lf)
+                {
+                    parser->skip_lf = false;
+                    if (*cur == '\n')
+                    {
+                        cur++;
+                        continue;
+                    }
+                }
+
+                next = find_special(cur, end);
+                if (next > cur)
+                {
+                    appendBinaryStringInfo(&parser->row, cur, next - cur);
+                    parser->row_started = true;
+                    cur = next;
+                }
+                if (cur == end)
+                    break;
+
+                switch (*cur)
+                {
+                    case ',':
+                        end_field(parser);
+                        parser->row_started = true;
+                        break;
+                    case '"':
+                        /* Quotes only open a field at its start, elsewhere they are data */
+                        if (parser->row.len == parser->field_start)
+                            parser->state = CSV_QUOTED;
+                        else
+                            appendStringInfoChar(&parser->row, '"');
+                        parser->row_started = true;
+                        break;
+                    case '\r':
+                        parser->skip_lf = true;
+                        /* FALLTHROUGH */
+                    case '\n':
+                        /*
+                         * A blank line is a row of one empty field, such as an
+                         * empty cell of a one-column sheet.  The newline that
+                         * ends the input starts no row, see csv_parser_finish.
+                         */
+                        end_row(parser);
+                        break;
+                }
+                cur++;
+                break;
+
+            case CSV_QUOTED:
+                next = find_quote(cur, end);
+                appendBinaryStringInfo(&parser->row, cur, next - cur);
+                cur = next;
+                if (cur < end)
+                {
+                    parser->state = CSV_QUOTE_SEEN;
+                    cur++;
+                }
+                break;
+
+            case CSV_QUOTE_SEEN:
+                if (*cur == '"')
+                {
+                    /* Doubled quote is an escaped quote */
+                    appendStringInfoChar(&parser->row, '"');
+                    parser->state = CSV_QUOTED;
+                    cur++;
+                }
+                else
+                    parser->state = CSV_UNQUOTED;
+                break;
+        }
+    }
+}
+
+/* Emit the last row if the input did not end with a newline */
+void csv_parser_finish(CsvParser *parser)
+{
+    if (parser->row_started)
+        end_row(parser);
+    parser->state = CSV_UNQUOTED;
+}
@@ -0,0 +1,33 @@
+#ifndef CSV_PARSER_H
+#define CSV_PARSER_H
+
+#include "lib/stringinfo.h"
+
+/* Called once per parsed row, the fields are only valid during the call */
+typedef void (*csv_row_callback)(char **fields, int nfields, void *arg);
+
+typedef enum CsvState {
+    CSV_UNQUOTED,           /* in an unquoted field or at the start of a field */
+    CSV_QUOTED,             /* inside a quoted field */
+    CSV_QUOTE_SEEN          /* saw a quote inside a quoted field */
+} CsvState;
+
+typedef struct CsvParser {
+    CsvState state;
+    StringInfoData row;     /* unescaped fields of the current row, NUL separated */
+    int field_start;        /* offset of the current field in row */
+    int *offsets;           /* offsets of the completed fields in row */
+    char **fields;
+    int nfields;
+    int maxfields;
+    bool row_started;
+    bool skip_lf;           /* previous row ended with CR */
+    csv_row_callback callback;
+    void *arg;
+} CsvParser;
+
+void csv_parser_init(CsvParser *parser, csv_row_callback callback, void *arg);
+void csv_parser_feed(CsvParser *parser, const char *data, size_t len);
+void csv_parser_finish(CsvParser *parser);
+
+#endif // CSV_PARSER_H
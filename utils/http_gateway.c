@@ -0,0 +1,693 @@
+#include "postgres.h"
+
+#include <signal.h>
+
+#include "http_gateway.h"
+#include "tracing.h"
+
+#include "lib/ilist.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/interrupt.h"
+#include "storage/dsm.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/shm_toc.h"
+#include "storage/shmem.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/timestamp.h"
+#include "utils/wait_event.h"
+
+/*
+ * Optional background worker that performs HTTP requests for all backends
+ * through one curl multi handle, so TLS sessions and HTTP/2 connections to
+ * Google stay warm and are shared by concurrent requests.
+ *
+ * A backend creates a DSM segment holding two message queues and puts its
+ * handle in a ring in shared memory.  Over the first queue it sends the
+ * request, as a descriptor message followed by the body; over the second it
+ * receives the response as tagged messages:
+ *
+ *   'D' <bytes>     a chunk of the response body
+ *   'E' <message>   the request failed
+ *   'C'             the request completed
+ *
+ * The worker stops reading from a connection while a backend has not taken
+ * the previous chunk, so a slow consumer never makes it buffer a response.
+ */
+
+#define GATEWAY_MAGIC 0x67736877
+#define GATEWAY_QUEUE_SIZE 65536
+#define GATEWAY_RING_SIZE 64
+
+/* Slack on the worker's own timeouts before a backend stops waiting */
+#define GATEWAY_GRACE_MS 5000
+/* What curl waits for a connection when no connect timeout is set */
+#define CURL_CONNECT_DEFAULT_MS 300000
+
+typedef struct GatewayShared {
+    LWLock *lock;
+    pid_t worker_pid;           /* 0 while no worker runs */
+    Latch *worker_latch;
+    int head;                   /* next slot to take */
+    int count;
+    dsm_handle ring[GATEWAY_RING_SIZE];
+} GatewayShared;
+
+typedef enum GatewayJobState {
+    JOB_READ_DESCRIPTOR,
+    JOB_READ_BODY,
+    JOB_RUNNING,
+    JOB_FINISHING               /* transfer done, final message pending */
+} GatewayJobState;
+
+typedef struct GatewayJob {
+    dlist_node node;
+    GatewayJobState state;
+    dsm_segment *seg;
+    shm_mq_handle *in;
+    shm_mq_handle *out;
+    CURL *curl;
+    struct curl_slist *headers;
+    char *method;
+    char *url;
+    StringInfoData body;
+    int32 connect_timeout;
+    int32 request_timeout;
+    int32 stall_timeout;
+    bool fail_on_error;
+    StringInfoData pending;     /* message not yet accepted by the queue */
+    bool paused;                /* curl is holding data back for us */
+    char final_tag;
+    char *final_message;
+} GatewayJob;
+
+bool http_gateway_enabled = false;
+
+static GatewayShared *gateway = NULL;
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static void gateway_shmem_request(void)
+{
+    if (prev_shmem_request_hook)
+        prev_shmem_request_hook();
+
+    RequestAddinShmemSpace(MAXALIGN(sizeof(GatewayShared)));
+    RequestNamedLWLockTranche("gsheets_gateway", 1);
+}
+
+static void gateway_shmem_startup(void)
+{
+    bool found;
+
+    if (prev_shmem_startup_hook)
+        prev_shmem_startup_hook();
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+    gateway = ShmemInitStruct("gsheets_gateway", sizeof(GatewayShared), &found);
+    if (!found)
+    {
+        gateway->lock = &(GetNamedLWLockTranche("gsheets_gateway"))->lock;
+        gateway->worker_pid = 0;
+        gateway->worker_latch = NULL;
+        gateway->head = 0;
+        gateway->count = 0;
+    }
+    LWLockRelease(AddinShmemInitLock);
+}
+
+/* Called from _PG_init while shared_preload_libraries is processed */
+void http_gateway_register(void)
+{
+    BackgroundWorker worker;
+
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = gateway_shmem_request;
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = gateway_shmem_startup;
+
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+    worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+    worker.bgw_restart_time = 5;
+    snprintf(worker.bgw_library_name, BGW_MAXLEN, "gsheets");
+    snprintf(worker.bgw_function_name, BGW_MAXLEN, "http_gateway_main");
+    snprintf(worker.bgw_name, BGW_MAXLEN, "gsheets http gateway");
+    snprintf(worker.bgw_type, BGW_MAXLEN, "gsheets http gateway");
+    RegisterBackgroundWorker(&worker);
+}
+
+static bool gateway_running(void)
+{
+    return gateway != NULL && gateway->worker_pid != 0;
+}
+
+/* Whether the worker a request was queued with still runs */
+static bool worker_alive(pid_t pid)
+{
+    return gateway->worker_pid == pid && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+/*
+ * Whether a request the worker abandoned can be made locally instead: it
+ * never took the request, or it is a GET of which nothing was received.
+ */
+static bool retry_locally(shm_mq *req_mq, const char *method, size_t received)
+{
+    return received == 0 &&
+        (shm_mq_get_receiver(req_mq) == NULL || strcmp(method, "GET") == 0);
+}
+
+/*
+ * Wait for the worker to make progress on a request started at 'started'
+ * and last advanced at 'progress'.  The worker applies the request's
+ * timeouts itself; if it lets them pass by more than GATEWAY_GRACE_MS it
+ * is stuck and the request fails instead of waiting forever.  Silence is
+ * allowed for a connection attempt plus a stall.
+ */
+static void gateway_wait(const char *method, TimestampTz started, TimestampTz progress)
+{
+    TimestampTz now = GetCurrentTimestamp();
+    int64 idle_ms = (http_connect_timeout > 0 ? http_connect_timeout : CURL_CONNECT_DEFAULT_MS) +
+        (int64) http_stall_timeout * 1000 + GATEWAY_GRACE_MS;
+
+    if ((http_request_timeout > 0 &&
+         now >= TimestampTzPlusMilliseconds(started, (int64) http_request_timeout + GATEWAY_GRACE_MS)) ||
+        now >= TimestampTzPlusMilliseconds(progress, idle_ms))
+        ereport(ERROR,
+                (errcode(ERRCODE_CONNECTION_FAILURE),
+                 errmsg("%s request failed: HTTP gateway worker timed out", method)));
+
+    (void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                     1000, gsheets_wait_event(WAIT_GATEWAY_REQUEST));
+    ResetLatch(MyLatch);
+    CHECK_FOR_INTERRUPTS();
+}
+
+/*
+ * Hand a request to the gateway worker and wait for its response, which is
+ * passed to 'sink' or returned malloc'd in *result like a local request.
+ *
+ * Returns false if there is no worker, it is saturated, or it went away
+ * before the request could have had an effect; the caller then performs
+ * the request itself.
+ */
+bool http_gateway_request(const char *method, const char *url, const char *data,
+                          struct curl_slist *headers, http_sink sink, void *sink_arg,
+                          char **result)
+{
+    shm_toc_estimator e;
+    Size size;
+    dsm_segment *seg;
+    shm_toc *toc;
+    shm_mq *req_mq;
+    shm_mq *resp_mq;
+    shm_mq_handle *req_mqh;
+    shm_mq_handle *resp_mqh;
+    StringInfoData desc;
+    StringInfoData body;
+    Latch *worker_latch = NULL;
+    pid_t worker_pid = 0;
+    TimestampTz started;
+    TimestampTz progress;
+    bool gone = false;
+    bool queued = false;
+    bool sent_desc = false;
+    bool sent_body = false;
+    size_t received = 0;
+
+    if (!gateway_running())
+        return false;
+
+    shm_toc_initialize_estimator(&e);
+    shm_toc_estimate_chunk(&e, GATEWAY_QUEUE_SIZE);
+    shm_toc_estimate_chunk(&e, GATEWAY_QUEUE_SIZE);
+    shm_toc_estimate_keys(&e, 2);
+    size = shm_toc_estimate(&e);
+
+    seg = dsm_create(size, DSM_CREATE_NULL_IF_MAXSEGMENTS);
+    if (seg == NULL)
+        return false;
+
+    toc = shm_toc_create(GATEWAY_MAGIC, dsm_segment_address(seg), size);
+    req_mq = shm_mq_create(shm_toc_allocate(toc, GATEWAY_QUEUE_SIZE), GATEWAY_QUEUE_SIZE);
+    shm_toc_insert(toc, 0, req_mq);
+    resp_mq = shm_mq_create(shm_toc_allocate(toc, GATEWAY_QUEUE_SIZE), GATEWAY_QUEUE_SIZE);
+    shm_toc_insert(toc, 1, resp_mq);
+
+    shm_mq_set_sender(req_mq, MyProc);
+    shm_mq_set_receiver(resp_mq, MyProc);
+    req_mqh = shm_mq_attach(req_mq, seg, NULL);
+    resp_mqh = shm_mq_attach(resp_mq, seg, NULL);
+
+    LWLockAcquire(gateway->lock, LW_EXCLUSIVE);
+    if (gateway->worker_pid != 0 && gateway->count < GATEWAY_RING_SIZE)
+    {
+        gateway->ring[(gateway->head + gateway->count) % GATEWAY_RING_SIZE] = dsm_segment_handle(seg);
+        gateway->count++;
+        worker_latch = gateway->worker_latch;
+        worker_pid = gateway->worker_pid;
+        queued = true;
+    }
+    LWLockRelease(gateway->lock);
+
+    if (!queued)
+    {
+        dsm_detach(seg);
+        return false;
+    }
+    SetLatch(worker_latch);
+    started = progress = GetCurrentTimestamp();
+
+    /* Descriptor: timeouts, fail-on-error flag, method, URL, then headers */
+    initStringInfo(&desc);
+    appendBinaryStringInfo(&desc, (char *) &http_connect_timeout, sizeof(int32));
+    appendBinaryStringInfo(&desc, (char *) &http_request_timeout, sizeof(int32));
+    appendBinaryStringInfo(&desc, (char *) &http_stall_timeout, sizeof(int32));
+    appendStringInfoChar(&desc, sink != NULL);
+    appendBinaryStringInfo(&desc, method, strlen(method) + 1);
+    appendBinaryStringInfo(&desc, url, strlen(url) + 1);
+    for (struct curl_slist *h = headers; h != NULL; h = h->next)
+        appendBinaryStringInfo(&desc, h->data, strlen(h->data) + 1);
+
+    /* Do not wait for a worker that has gone before it took the request */
+    while (!sent_body)
+    {
+        shm_mq_result res;
+
+        if (!sent_desc)
+            res = shm_mq_send(req_mqh, desc.len, desc.data, true, true);
+        else
+            res = shm_mq_send(req_mqh, data ? strlen(data) : 0, data ? data : "", true, true);
+
+        if (res == SHM_MQ_SUCCESS)
+        {
+            if (sent_desc)
+                sent_body = true;
+            sent_desc = true;
+            progress = GetCurrentTimestamp();
+            continue;
+        }
+
+        if (res == SHM_MQ_DETACHED || !worker_alive(worker_pid))
+        {
+            if (!retry_locally(req_mq, method, received))
+                ereport(ERROR,
+                        (errcode(ERRCODE_CONNECTION_FAILURE),
+                         errmsg("%s request failed: HTTP gateway worker exited", method)));
+            dsm_detach(seg);
+            return false;
+        }
+        gateway_wait(method, started, progress);
+    }
+    pfree(desc.data);
+
+    initStringInfo(&body);
+    for (;;)
+    {
+        Size nbytes;
+        void *msg;
+        shm_mq_result res = shm_mq_receive(resp_mqh, &nbytes, &msg, true);
+
+        /* Take what a worker that has died managed to send before giving up */
+        if ((res == SHM_MQ_WOULD_BLOCK && gone) || res == SHM_MQ_DETACHED)
+        {
+            if (!retry_locally(req_mq, method, received))
+                ereport(ERROR,
+                        (errcode(ERRCODE_CONNECTION_FAILURE),
+                         errmsg("%s request failed: HTTP gateway worker exited", method)));
+            dsm_detach(seg);
+            pfree(body.data);
+            return false;
+        }
+        if (res == SHM_MQ_WOULD_BLOCK)
+        {
+            gone = !worker_alive(worker_pid);
+            if (!gone)
+                gateway_wait(method, started, progress);
+            continue;
+        }
+        progress = GetCurrentTimestamp();
+
+        if (nbytes == 0)
+            elog(ERROR, "empty message from HTTP gateway worker");
+
+        switch (((char *) msg)[0])
+        {
+            case 'D':
+                received += nbytes - 1;
+                if (sink)
+                    sink((char *) msg + 1, nbytes - 1, sink_arg);
+                else
+                    appendBinaryStringInfo(&body, (char *) msg + 1, nbytes - 1);
+                continue;
+            case 'E':
+                ereport(ERROR,
+                        (errcode(ERRCODE_CONNECTION_FAILURE),
+                         errmsg("%s request failed: %.*s", method,
+                                (int) nbytes - 1, (char *) msg + 1)));
+                break;
+            case 'C':
+                break;
+            default:
+                elog(ERROR, "unexpected message type \"%c\" from HTTP gateway worker",
+                     ((char *) msg)[0]);
+        }
+        break;
+    }
+
+    dsm_detach(seg);
+
+    /* Callers free() response bodies */
+    *result = NULL;
+    if (!sink)
+    {
+        *result = malloc(body.len + 1);
+        if (*result == NULL)
+            ereport(ERROR,
+                    (errcode(ERRCODE_OUT_OF_MEMORY),
+                     errmsg("out of memory")));
+        memcpy(*result, body.data, body.len + 1);
+    }
+    pfree(body.data);
+
+    TRACE_GSHEETS_HTTP_DONE(method, url, received);
+    return true;
+}
+
+/* Worker side */
+
+static dlist_head jobs = DLIST_STATIC_INIT(jobs);
+static HttpPoller poller;
+
+static size_t gateway_write(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    GatewayJob *job = (GatewayJob *) userp;
+    size_t real_size = size * nmemb;
+
+    /* Until the backend has taken the previous chunk curl keeps the data */
+    if (job->pending.len > 0)
+    {
+        job->paused = true;
+        return CURL_WRITEFUNC_PAUSE;
+    }
+
+    appendStringInfoChar(&job->pending, 'D');
+    appendBinaryStringInfo(&job->pending, contents, real_size);
+    return real_size;
+}
+
+static void gateway_shmem_exit(int code, Datum arg)
+{
+    LWLockAcquire(gateway->lock, LW_EXCLUSIVE);
+    gateway->worker_pid = 0;
+    gateway->worker_latch = NULL;
+    LWLockRelease(gateway->lock);
+}
+
+static void free_job(GatewayJob *job)
+{
+    dlist_delete(&job->node);
+    if (job->curl != NULL)
+    {
+        curl_multi_remove_handle(poller.multi, job->curl);
+        curl_easy_cleanup(job->curl);
+    }
+    curl_slist_free_all(job->headers);
+    dsm_detach(job->seg);
+    if (job->method)
+        pfree(job->method);
+    if (job->url)
+        pfree(job->url);
+    if (job->final_message)
+        pfree(job->final_message);
+    pfree(job->body.data);
+    pfree(job->pending.data);
+    pfree(job);
+}
+
+/* Take the requests backends have queued */
+static void accept_jobs(void)
+{
+    for (;;)
+    {
+        dsm_handle handle;
+        dsm_segment *seg;
+        shm_toc *toc;
+        shm_mq *req_mq;
+        shm_mq *resp_mq;
+        GatewayJob *job;
+
+        LWLockAcquire(gateway->lock, LW_EXCLUSIVE);
+        if (gateway->count == 0)
+        {
+            LWLockRelease(gateway->lock);
+            return;
+        }
+        handle = gateway->ring[gateway->head];
+        gateway->head = (gateway->head + 1) % GATEWAY_RING_SIZE;
+        gateway->count--;
+        LWLockRelease(gateway->lock);
+
+        /* The backend may have given up already */
+        seg = dsm_attach(handle);
+        if (seg == NULL)
+            continue;
+        toc = shm_toc_attach(GATEWAY_MAGIC, dsm_segment_address(seg));
+        if (toc == NULL)
+        {
+            dsm_detach(seg);
+            continue;
+        }
+
+        req_mq = shm_toc_lookup(toc, 0, false);
+        resp_mq = shm_toc_lookup(toc, 1, false);
+        shm_mq_set_receiver(req_mq, MyProc);
+        shm_mq_set_sender(resp_mq, MyProc);
+
+        job = palloc0(sizeof(GatewayJob));
+        job->state = JOB_READ_DESCRIPTOR;
+        job->seg = seg;
+        job->in = shm_mq_attach(req_mq, seg, NULL);
+        job->out = shm_mq_attach(resp_mq, seg, NULL);
+        initStringInfo(&job->body);
+        initStringInfo(&job->pending);
+        dlist_push_tail(&jobs, &job->node);
+    }
+}
+
+static void parse_descriptor(GatewayJob *job, const char *msg, Size len)
+{
+    const char *cur = msg + 3 * sizeof(int32) + 1;
+    const char *end = msg + len;
+
+    memcpy(&job->connect_timeout, msg, sizeof(int32));
+    memcpy(&job->request_timeout, msg + sizeof(int32), sizeof(int32));
+    memcpy(&job->stall_timeout, msg + 2 * sizeof(int32), sizeof(int32));
+    job->fail_on_error = msg[3 * sizeof(int32)] != 0;
+
+    job->method = pstrdup(cur);
+    cur += strlen(cur) + 1;
+    job->url = pstrdup(cur);
+    cur += strlen(cur) + 1;
+    while (cur < end)
+    {
+        job->headers = curl_slist_append(job->headers, cur);
+        cur += strlen(cur) + 1;
+    }
+}
+
+static void start_job(GatewayJob *job)
+{
+    CURL *curl = curl_easy_init();
+
+    if (curl == NULL)
+    {
+        job->state = JOB_FINISHING;
+        job->final_tag = 'E';
+        job->final_message = pstrdup("curl_easy_init() failed");
+        return;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, job->url);
+    if (strcmp(job->method, "GET") != 0)
+    {
+        if (strcmp(job->method, "POST") != 0)
+            curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, job->method);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long) job->body.len);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, job->body.data);
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, gateway_write);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *) job);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, (void *) job);
+    if (job->fail_on_error)
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, job->headers);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long) job->connect_timeout);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long) job->request_timeout);
+    /* Paused transfers are exempt, a slow backend does not count as a stall */
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long) job->stall_timeout);
+    /* Prefer waiting for a multiplexed stream over opening a connection */
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+    job->curl = curl;
+    job->state = JOB_RUNNING;
+    curl_multi_add_handle(poller.multi, curl);
+}
+
+/*
+ * Move a job along as far as its queues allow.  Returns false once the job
+ * is over, either done or abandoned by its backend.
+ */
+static bool advance_job(GatewayJob *job)
+{
+    shm_mq_result res;
+    Size nbytes;
+    void *msg;
+
+    if (job->state == JOB_READ_DESCRIPTOR)
+    {
+        res = shm_mq_receive(job->in, &nbytes, &msg, true);
+        if (res == SHM_MQ_DETACHED)
+            return false;
+        if (res == SHM_MQ_WOULD_BLOCK)
+            return true;
+        parse_descriptor(job, msg, nbytes);
+        job->state = JOB_READ_BODY;
+    }
+
+    if (job->state == JOB_READ_BODY)
+    {
+        res = shm_mq_receive(job->in, &nbytes, &msg, true);
+        if (res == SHM_MQ_DETACHED)
+            return false;
+        if (res == SHM_MQ_WOULD_BLOCK)
+            return true;
+        appendBinaryStringInfo(&job->body, msg, nbytes);
+        start_job(job);
+    }
+
+    for (;;)
+    {
+        if (job->pending.len > 0)
+        {
+            res = shm_mq_send(job->out, job->pending.len, job->pending.data, true, true);
+            if (res == SHM_MQ_DETACHED)
+                return false;
+            if (res == SHM_MQ_WOULD_BLOCK)
+                return true;
+            resetStringInfo(&job->pending);
+
+            if (job->paused)
+            {
+                /* May deliver held back data right away, refilling pending */
+                job->paused = false;
+                curl_easy_pause(job->curl, CURLPAUSE_CONT);
+                continue;
+            }
+        }
+
+        if (job->state != JOB_FINISHING)
+            return true;
+        if (job->final_tag == '\0')
+            return false;
+
+        appendStringInfoChar(&job->pending, job->final_tag);
+        if (job->final_message)
+            appendStringInfoString(&job->pending, job->final_message);
+        job->final_tag = '\0';
+    }
+}
+
+static void collect_finished(void)
+{
+    CURLMsg *msg;
+    int msgs_left;
+
+    while ((msg = curl_multi_info_read(poller.multi, &msgs_left)) != NULL)
+    {
+        char *private;
+        GatewayJob *job;
+
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &private);
+        job = (GatewayJob *) private;
+        job->state = JOB_FINISHING;
+        if (msg->data.result == CURLE_OK)
+            job->final_tag = 'C';
+        else
+        {
+            job->final_tag = 'E';
+            job->final_message = pstrdup(curl_easy_strerror(msg->data.result));
+        }
+    }
+}
+
+void http_gateway_main(Datum main_arg)
+{
+    CURLM *multi;
+
+    pqsignal(SIGHUP, SignalHandlerForConfigReload);
+    pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+    BackgroundWorkerUnblockSignals();
+
+    multi = curl_multi_init();
+    if (multi == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("curl_multi_init() failed")));
+    /* Requests to the same host share connections as HTTP/2 streams */
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    MemoryContextSwitchTo(AllocSetContextCreate(TopMemoryContext,
+                                                "gsheets http gateway",
+                                                ALLOCSET_DEFAULT_SIZES));
+    http_poller_init(&poller, multi);
+
+    LWLockAcquire(gateway->lock, LW_EXCLUSIVE);
+    gateway->worker_pid = MyProcPid;
+    gateway->worker_latch = MyLatch;
+    LWLockRelease(gateway->lock);
+    on_shmem_exit(gateway_shmem_exit, (Datum) 0);
+
+    while (!ShutdownRequestPending)
+    {
+        dlist_mutable_iter iter;
+
+        accept_jobs();
+        collect_finished();
+
+        dlist_foreach_modify(iter, &jobs)
+        {
+            GatewayJob *job = dlist_container(GatewayJob, node, iter.cur);
+
+            if (!advance_job(job))
+                free_job(job);
+        }
+
+        if (http_poller_wait(&poller, http_poller_timeout(&poller, 1000),
+                             gsheets_wait_event(WAIT_GATEWAY_MAIN)))
+        {
+            CHECK_FOR_INTERRUPTS();
+            if (ConfigReloadPending)
+            {
+                ConfigReloadPending = false;
+                ProcessConfigFile(PGC_SIGHUP);
+            }
+        }
+    }
+
+    proc_exit(0);
+}
@@ -0,0 +1,17 @@
+#ifndef HTTP_GATEWAY_H
+#define HTTP_GATEWAY_H
+
+#include "http_helpers.h"
+
+/* Set from postgresql.conf, the worker only exists when preloaded */
+extern bool http_gateway_enabled;
+
+void http_gateway_register(void);
+
+bool http_gateway_request(const char *method, const char *url, const char *data,
+                          struct curl_slist *headers, http_sink sink, void *sink_arg,
+                          char **result);
+
+PGDLLEXPORT void http_gateway_main(Datum main_arg);
+
+#endif // HTTP_GATEWAY_H
@@ -1,11 +1,53 @@
 #include "postgres.h"
 #include "http_helpers.h"
+#include "http_gateway.h"
+#include "tracing.h"
+
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "storage/latch.h"
+#include "utils/timestamp.h"
+#include "utils/wait_event.h"
+
+/* Number of time-to-first-byte samples kept for the hedging percentile */
+#define HEDGE_SAMPLES 64
+/* Do not hedge until we have seen this many responses */
+#define HEDGE_MIN_SAMPLES 8
+
+int http_connect_timeout = 10000;
+int http_request_timeout = 0;
+int http_stall_timeout = 60;
+int http_hedge_percentile = 0;
+int http_hedge_min_delay = 50;
 
 struct Response {
     char *data;
     size_t size;
+    bool first_byte;
+    http_sink sink;
+    void *sink_arg;
+    ErrorData *error;
 };
 
+typedef struct HttpTransfer {
+    CURL *curl;
+    struct Response response;
+} HttpTransfer;
+
+/* State of one request, kept in one place so an error can release it */
+typedef struct HttpRequest {
+    HttpPoller poller;
+    HttpTransfer transfers[2];
+    int ntransfers;
+    HttpTransfer *winner;
+} HttpRequest;
+
+static HttpStats stats = {0, 0, 0};
+
+static long ttfb_samples[HEDGE_SAMPLES];
+static int ttfb_count = 0;
+static int ttfb_next = 0;
+
 static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t real_size = size * nmemb;
     struct Response *resp = (struct Response *)userp;
@@ -19,6 +61,32 @@ static size_t WriteCallback(void *contents, size_t size, size_t nmemb, void *use
     memcpy(&(resp->data[resp->size]), contents, real_size);
     resp->size += real_size;
     resp->data[resp->size] = 0;
+    resp->first_byte = true;
+
+    return real_size;
+}
+
+static size_t StreamCallback(void *contents, size_t size, size_t nmemb, void *userp) {
+    volatile size_t real_size = size * nmemb;
+    struct Response *resp = (struct Response *)userp;
+    MemoryContext mcxt = CurrentMemoryContext;
+
+    resp->size += real_size;
+    resp->first_byte = true;
+
+    /* Errors must not longjmp through libcurl, keep them for later */
+    PG_TRY();
+    {
+        resp->sink(contents, real_size, resp->sink_arg);
+    }
+    PG_CATCH();
+    {
+        MemoryContextSwitchTo(mcxt);
+        resp->error = CopyErrorData();
+        FlushErrorState();
+        real_size = 0;
+    }
+    PG_END_TRY();
 
     return real_size;
 }
@@ -33,127 +101,516 @@ void http_cleanup(void)
     curl_global_cleanup();
 }
 
-char *http_get(const char* url, char* params[], size_t params_count, struct curl_slist* headers) {
-    CURL *curl;
-    CURLcode res;
-    struct Response response = { .data = NULL, .size = 0 };
-    char full_url[10000];
-    size_t i;
+const HttpStats *http_get_stats(void)
+{
+    return &stats;
+}
 
-    // Initialize response data
-    response.data = malloc(1);
-    response.size = 0;
+static char *build_url(const char *url, const char *params[], size_t params_count)
+{
+    StringInfoData full_url;
+    size_t i;
 
-    // Build the full URL with parameters
-    snprintf(full_url, sizeof(full_url), "%s", url);
+    initStringInfo(&full_url);
+    appendStringInfoString(&full_url, url);
     for (i = 0; i < params_count; ++i) {
-        strcat(full_url, i == 0 ? "?" : "&");
-        strcat(full_url, params[i]);
+        appendStringInfoChar(&full_url, i == 0 ? '?' : '&');
+        appendStringInfoString(&full_url, params[i]);
     }
 
-    curl = curl_easy_init();
-    if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, full_url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    return full_url.data;
+}
 
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            free(response.data);
-        }
+static int compare_long(const void *a, const void *b)
+{
+    long la = *(const long *) a;
+    long lb = *(const long *) b;
+
+    return (la > lb) - (la < lb);
+}
+
+static void record_ttfb(CURL *curl)
+{
+    curl_off_t ttfb;
+
+    if (curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb) != CURLE_OK)
+        return;
+
+    ttfb_samples[ttfb_next] = (long) (ttfb / 1000);
+    ttfb_next = (ttfb_next + 1) % HEDGE_SAMPLES;
+    if (ttfb_count < HEDGE_SAMPLES)
+        ttfb_count++;
+}
+
+/*
+ * Delay in milliseconds after which a duplicate request is sent if the first
+ * one has not produced any bytes yet, or -1 if hedging is off.  The delay is
+ * the configured percentile of recently observed time-to-first-byte.
+ */
+static long hedge_delay(void)
+{
+    long sorted[HEDGE_SAMPLES];
+    int idx;
+
+    if (http_hedge_percentile <= 0 || ttfb_count < HEDGE_MIN_SAMPLES)
+        return -1;
 
-        curl_easy_cleanup(curl);
+    memcpy(sorted, ttfb_samples, ttfb_count * sizeof(long));
+    qsort(sorted, ttfb_count, sizeof(long), compare_long);
+
+    idx = (ttfb_count * http_hedge_percentile + 99) / 100 - 1;
+    if (idx < 0)
+        idx = 0;
+
+    return Max(sorted[idx], (long) http_hedge_min_delay);
+}
+
+static void start_transfer(HttpTransfer *t, const char *method, const char *url,
+                           const char *data, struct curl_slist *headers,
+                           http_sink sink, void *sink_arg)
+{
+    t->response.data = malloc(1);
+    t->response.size = 0;
+    t->response.first_byte = false;
+    t->response.sink = sink;
+    t->response.sink_arg = sink_arg;
+    t->response.error = NULL;
+    if (t->response.data == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_OUT_OF_MEMORY),
+                 errmsg("out of memory")));
+    t->response.data[0] = '\0';
+
+    t->curl = curl_easy_init();
+    if (t->curl == NULL)
+    {
+        free(t->response.data);
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("curl_easy_init() failed")));
     }
 
-    return response.data;
+    curl_easy_setopt(t->curl, CURLOPT_URL, url);
+    if (strcmp(method, "GET") != 0)
+    {
+        if (strcmp(method, "POST") != 0)
+            curl_easy_setopt(t->curl, CURLOPT_CUSTOMREQUEST, method);
+        curl_easy_setopt(t->curl, CURLOPT_POSTFIELDS, data);
+    }
+    curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, sink ? StreamCallback : WriteCallback);
+    /* A streamed error body would be taken for data */
+    if (sink)
+        curl_easy_setopt(t->curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, (void *)&t->response);
+    curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, headers);
+    /* Export links redirect to a signed download URL */
+    curl_easy_setopt(t->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    /* Timeouts must not be implemented with SIGALRM, the backend owns it */
+    curl_easy_setopt(t->curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(t->curl, CURLOPT_CONNECTTIMEOUT_MS, (long) http_connect_timeout);
+    curl_easy_setopt(t->curl, CURLOPT_TIMEOUT_MS, (long) http_request_timeout);
+    /* A transfer that stops receiving is abandoned even without a request timeout */
+    curl_easy_setopt(t->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(t->curl, CURLOPT_LOW_SPEED_TIME, (long) http_stall_timeout);
 }
 
-char *http_post(const char* url, const char* data, const char* params[], size_t params_count, struct curl_slist* headers)
+static void finish_transfer(CURLM *multi, HttpTransfer *t, bool keep_data)
 {
-    CURL *curl;
-    CURLcode res;
-    struct Response response = { .data = NULL, .size = 0 };
-    char full_url[10000];
+    if (t->curl == NULL)
+        return;
+
+    curl_multi_remove_handle(multi, t->curl);
+    curl_easy_cleanup(t->curl);
+    t->curl = NULL;
+    if (!keep_data)
+        free(t->response.data);
+}
+
+/* curl tells us which sockets to watch for what */
+static int SocketCallback(CURL *easy, curl_socket_t fd, int what, void *userp, void *socketp)
+{
+    HttpPoller *poller = (HttpPoller *) userp;
+    int events = 0;
     int i;
 
-    // Initialize response data
-    response.data = malloc(1);
-    response.size = 0;
+    if (what == CURL_POLL_IN || what == CURL_POLL_INOUT)
+        events |= WL_SOCKET_READABLE;
+    if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT)
+        events |= WL_SOCKET_WRITEABLE;
 
-    // Build the full URL with parameters
-    snprintf(full_url, sizeof(full_url), "%s", url);
-    for (i = 0; i < params_count; ++i) {
-        strcat(full_url, i == 0 ? "?" : "&");
-        strcat(full_url, params[i]);
+    for (i = 0; i < poller->nsockets; i++)
+        if (poller->sockets[i].fd == fd)
+            break;
+
+    if (what == CURL_POLL_REMOVE)
+    {
+        if (i < poller->nsockets)
+            poller->sockets[i] = poller->sockets[--poller->nsockets];
+    }
+    else if (i < poller->nsockets)
+        poller->sockets[i].events = events;
+    else
+    {
+        if (poller->nsockets == poller->maxsockets)
+        {
+            poller->maxsockets *= 2;
+            poller->sockets = repalloc(poller->sockets, poller->maxsockets * sizeof(HttpSocket));
+        }
+        poller->sockets[poller->nsockets].fd = fd;
+        poller->sockets[poller->nsockets].events = events;
+        poller->nsockets++;
+    }
+
+    poller->sockets_changed = true;
+    return 0;
+}
+
+/* ... and when it wants to be called back regardless of socket activity */
+static int TimerCallback(CURLM *multi, long timeout_ms, void *userp)
+{
+    HttpPoller *poller = (HttpPoller *) userp;
+
+    poller->timer_set = timeout_ms >= 0;
+    if (poller->timer_set)
+        poller->timer_deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(), timeout_ms);
+    return 0;
+}
+
+static void socket_action(HttpPoller *poller, curl_socket_t fd, int ev)
+{
+    int running;
+    CURLMcode rc = curl_multi_socket_action(poller->multi, fd, ev, &running);
+
+    if (rc != CURLM_OK)
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("curl_multi_socket_action() failed: %s", curl_multi_strerror(rc))));
+}
+
+void http_poller_init(HttpPoller *poller, CURLM *multi)
+{
+    poller->multi = multi;
+    poller->maxsockets = 4;
+    poller->sockets = palloc(poller->maxsockets * sizeof(HttpSocket));
+    poller->nsockets = 0;
+    poller->sockets_changed = true;
+    poller->timer_set = false;
+    poller->wait_set = NULL;
+    poller->occurred = NULL;
+
+    curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, SocketCallback);
+    curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, poller);
+    curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, TimerCallback);
+    curl_multi_setopt(multi, CURLMOPT_TIMERDATA, poller);
+}
+
+/* max_ms, shortened to when curl's timer expires */
+long http_poller_timeout(HttpPoller *poller, long max_ms)
+{
+    if (!poller->timer_set)
+        return max_ms;
+
+    return Min(max_ms, TimestampDifferenceMilliseconds(GetCurrentTimestamp(),
+                                                       poller->timer_deadline));
+}
+
+/*
+ * Sleep until a curl socket is ready, the latch is set or timeout_ms passes,
+ * then let curl act on whatever happened.  Returns true if the latch was set,
+ * after resetting it; the caller then checks for whatever it was set for.
+ */
+bool http_poller_wait(HttpPoller *poller, long timeout_ms, uint32 wait_event_info)
+{
+    int nevents;
+    bool latch_set = false;
+
+    /* Sockets come and go as connections are made, rebuild the set then */
+    if (poller->sockets_changed)
+    {
+        if (poller->wait_set != NULL)
+            FreeWaitEventSet(poller->wait_set);
+        poller->wait_set = NULL;
+        if (poller->occurred != NULL)
+            pfree(poller->occurred);
+        poller->occurred = palloc((poller->nsockets + 2) * sizeof(WaitEvent));
+#if PG_VERSION_NUM >= 170000
+        poller->wait_set = CreateWaitEventSet(NULL, poller->nsockets + 2);
+#else
+        poller->wait_set = CreateWaitEventSet(CurrentMemoryContext, poller->nsockets + 2);
+#endif
+        AddWaitEventToSet(poller->wait_set, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+        AddWaitEventToSet(poller->wait_set, WL_EXIT_ON_PM_DEATH, PGINVALID_SOCKET, NULL, NULL);
+        for (int i = 0; i < poller->nsockets; i++)
+            if (poller->sockets[i].events != 0)
+                AddWaitEventToSet(poller->wait_set, poller->sockets[i].events,
+                                  poller->sockets[i].fd, NULL, NULL);
+        poller->nevents = poller->nsockets + 2;
+        poller->sockets_changed = false;
     }
 
-    curl = curl_easy_init();
-    if (curl)
+    nevents = WaitEventSetWait(poller->wait_set, timeout_ms, poller->occurred,
+                               poller->nevents, wait_event_info);
+
+    for (int i = 0; i < nevents; i++)
     {
-        curl_easy_setopt(curl, CURLOPT_URL, full_url);
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        WaitEvent *event = &poller->occurred[i];
+        int ev = 0;
 
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK)
+        if (event->events & WL_LATCH_SET)
         {
-            free(response.data);
-            ereport(ERROR,
-                    (errcode(ERRCODE_INTERNAL_ERROR),
-                     errmsg("curl_easy_perform() failed: %s", curl_easy_strerror(res))));
+            ResetLatch(MyLatch);
+            latch_set = true;
+            continue;
         }
 
-        curl_easy_cleanup(curl);
+        if (event->events & WL_SOCKET_READABLE)
+            ev |= CURL_CSELECT_IN;
+        if (event->events & WL_SOCKET_WRITEABLE)
+            ev |= CURL_CSELECT_OUT;
+        if (ev != 0)
+            socket_action(poller, event->fd, ev);
+    }
+
+    if (poller->timer_set && GetCurrentTimestamp() >= poller->timer_deadline)
+    {
+        poller->timer_set = false;
+        socket_action(poller, CURL_SOCKET_TIMEOUT, 0);
     }
 
-    return response.data;
+    return latch_set;
 }
 
-char *http_put(const char* url, const char* data, const char* params[], size_t params_count, struct curl_slist* headers)
+/* Free the wait set; the multi handle belongs to the caller */
+void http_poller_release(HttpPoller *poller)
 {
-    CURL *curl;
-    CURLcode res;
-    struct Response response = { .data = NULL, .size = 0 };
-    char full_url[10000];
-    int i;
+    if (poller->wait_set != NULL)
+    {
+        FreeWaitEventSet(poller->wait_set);
+        poller->wait_set = NULL;
+    }
+}
 
-    // Initialize response data
-    response.data = malloc(1);
-    response.size = 0;
+/* Wait event for the phase the furthest along transfer is in */
+static uint32 request_wait_event(HttpRequest *req)
+{
+    GSheetsWaitEvent event = WAIT_HTTP_CONNECT;
 
-    // Build the full URL with parameters
-    snprintf(full_url, sizeof(full_url), "%s", url);
-    for (i = 0; i < params_count; ++i) {
-        strcat(full_url, i == 0 ? "?" : "&");
-        strcat(full_url, params[i]);
+    for (int i = 0; i < req->ntransfers; i++)
+    {
+        curl_off_t pretransfer = 0;
+
+        if (req->transfers[i].response.first_byte)
+            return gsheets_wait_event(WAIT_HTTP_TRANSFER);
+
+        /* Set once connected and the request is about to be sent */
+        if (curl_easy_getinfo(req->transfers[i].curl, CURLINFO_PRETRANSFER_TIME_T,
+                              &pretransfer) == CURLE_OK && pretransfer > 0)
+            event = WAIT_HTTP_RESPONSE;
     }
 
-    curl = curl_easy_init();
-    if (curl)
+    return gsheets_wait_event(event);
+}
+
+/*
+ * Drive the request until a transfer succeeds, returning it, or all of them
+ * have failed, raising the error.  See http_request for hedging.
+ */
+static HttpTransfer *run_request(HttpRequest *req, const char *method, const char *url,
+                                 const char *data, struct curl_slist *headers, bool hedge,
+                                 http_sink sink, void *sink_arg)
+{
+    int nrunning;
+    HttpTransfer *winner = NULL;
+    CURLcode res = CURLE_OK;
+    long delay = (hedge && sink == NULL) ? hedge_delay() : -1;
+    ErrorData *error = NULL;
+    TimestampTz start = GetCurrentTimestamp();
+
+    start_transfer(&req->transfers[0], method, url, data, headers, sink, sink_arg);
+    req->ntransfers = 1;
+    curl_multi_add_handle(req->poller.multi, req->transfers[0].curl);
+    nrunning = 1;
+
+    while (winner == NULL && nrunning > 0)
     {
-        curl_easy_setopt(curl, CURLOPT_URL, full_url);
-        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&response);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        long timeout_ms = 1000;
+        CURLMsg *msg;
+        int msgs_left;
+
+        CHECK_FOR_INTERRUPTS();
+
+        if (delay >= 0 && req->ntransfers == 1 && !req->transfers[0].response.first_byte)
+        {
+            long elapsed = TimestampDifferenceMilliseconds(start, GetCurrentTimestamp());
+
+            if (elapsed >= delay)
+            {
+                start_transfer(&req->transfers[1], method, url, data, headers, NULL, NULL);
+                req->ntransfers = 2;
+                curl_multi_add_handle(req->poller.multi, req->transfers[1].curl);
+                nrunning++;
+                stats.hedged++;
+                continue;
+            }
+            timeout_ms = Min(timeout_ms, delay - elapsed);
+        }
+
+        /* Cancel and statement_timeout set the latch, even while the server is silent */
+        if (http_poller_wait(&req->poller, http_poller_timeout(&req->poller, timeout_ms),
+                             request_wait_event(req)))
+            CHECK_FOR_INTERRUPTS();
 
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK)
+        while ((msg = curl_multi_info_read(req->poller.multi, &msgs_left)) != NULL)
         {
-            free(response.data);
-            ereport(ERROR,
-                    (errcode(ERRCODE_INTERNAL_ERROR),
-                     errmsg("curl_easy_perform() failed: %s", curl_easy_strerror(res))));
+            HttpTransfer *t;
+
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            t = (msg->easy_handle == req->transfers[0].curl) ? &req->transfers[0] : &req->transfers[1];
+            nrunning--;
+
+            if (msg->data.result == CURLE_OK && winner == NULL)
+                winner = t;
+            else if (msg->data.result != CURLE_OK)
+            {
+                res = msg->data.result;
+                if (t->response.error != NULL)
+                    error = t->response.error;
+                finish_transfer(req->poller.multi, t, false);
+            }
         }
+    }
 
-        curl_easy_cleanup(curl);
+    if (winner == NULL)
+    {
+        if (error != NULL)
+            ReThrowError(error);
+        ereport(ERROR,
+                (errcode(ERRCODE_CONNECTION_FAILURE),
+                 errmsg("%s request failed: %s", method, curl_easy_strerror(res))));
     }
 
-    return response.data;
+    return winner;
+}
+
+/* Free everything a request holds except the body of 'keep' */
+static void release_request(HttpRequest *req, HttpTransfer *keep)
+{
+    http_poller_release(&req->poller);
+
+    for (int i = 0; i < req->ntransfers; i++)
+        finish_transfer(req->poller.multi, &req->transfers[i], &req->transfers[i] == keep);
+
+    curl_multi_cleanup(req->poller.multi);
+}
+
+/*
+ * Perform a request and return the malloc'd response body.
+ *
+ * When 'hedge' is set (idempotent requests only) and the request has not
+ * received its first byte within hedge_delay(), an identical request is sent
+ * and whichever completes first successfully wins.
+ *
+ * When 'sink' is set the body is passed to it as it arrives instead, and
+ * NULL is returned.  Streamed requests are never hedged.
+ *
+ * The backend stays responsive to cancel and statement_timeout throughout;
+ * on any error the curl handles and buffers are released before rethrowing.
+ *
+ * When the gateway worker is running the request is handed to it instead,
+ * to reuse its pooled connections; hedging only applies to local requests.
+ */
+static char *http_request(const char *method, const char *url, const char *data,
+                          const char *params[], size_t params_count,
+                          struct curl_slist *headers, bool hedge,
+                          http_sink sink, void *sink_arg)
+{
+    char *full_url = build_url(url, params, params_count);
+    HttpRequest *req;
+    CURLM *multi;
+    HttpTransfer *winner;
+    char *result;
+
+    TRACE_GSHEETS_HTTP_START(method, full_url);
+
+    /* Requests go through the shared gateway worker when there is one */
+    if (http_gateway_request(method, full_url, data, headers, sink, sink_arg, &result))
+    {
+        stats.requests++;
+        pfree(full_url);
+        return result;
+    }
+
+    multi = curl_multi_init();
+    if (multi == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("curl_multi_init() failed")));
+
+    req = palloc0(sizeof(HttpRequest));
+    http_poller_init(&req->poller, multi);
+
+    PG_TRY();
+    {
+        req->winner = run_request(req, method, full_url, data, headers, hedge, sink, sink_arg);
+    }
+    PG_CATCH();
+    {
+        release_request(req, NULL);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    winner = req->winner;
+    TRACE_GSHEETS_HTTP_DONE(method, full_url, winner->response.size);
+    record_ttfb(winner->curl);
+    stats.requests++;
+    if (winner == &req->transfers[1])
+        stats.hedge_wins++;
+
+    result = sink ? NULL : winner->response.data;
+    release_request(req, sink ? NULL : winner);
+    pfree(req);
+    pfree(full_url);
+
+    return result;
+}
+
+char *http_get(const char* url, char* params[], size_t params_count, struct curl_slist* headers) {
+    return http_request("GET", url, NULL, (const char **) params, params_count, headers, true, NULL, NULL);
+}
+
+void http_get_stream(const char* url, char* params[], size_t params_count, struct curl_slist* headers,
+                     http_sink sink, void *arg)
+{
+    http_request("GET", url, NULL, (const char **) params, params_count, headers, false, sink, arg);
+}
+
+char *http_post(const char* url, const char* data, const char* params[], size_t params_count, struct curl_slist* headers)
+{
+    return http_request("POST", url, data, params, params_count, headers, false, NULL, NULL);
+}
+
+char *http_put(const char* url, const char* data, const char* params[], size_t params_count, struct curl_slist* headers)
+{
+    return http_request("PUT", url, data, params, params_count, headers, false, NULL, NULL);
+}
+
+/* Percent-encode a query string or path component, result is palloc'd */
+char *url_encode(const char *str)
+{
+    char *escaped = curl_easy_escape(NULL, str, 0);
+    char *result;
+
+    if (escaped == NULL)
+        ereport(ERROR,
+                (errcode(ERRCODE_OUT_OF_MEMORY),
+                 errmsg("out of memory")));
+
+    result = pstrdup(escaped);
+    curl_free(escaped);
+    return result;
 }
 
 struct curl_slist *add_header(struct curl_slist* headers, const char* header_key, const char* header_value)
@@ -162,4 +619,4 @@ struct curl_slist *add_header(struct curl_slist* headers, const char* header_key
     snprintf(header, sizeof(header), "%s: %s", header_key, header_value);
     headers = curl_slist_append(headers, header);
     return headers;
-}
\ No newline at end of file
+}
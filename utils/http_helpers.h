@@ -6,12 +6,67 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "datatype/timestamp.h"
+#include "storage/latch.h"
+
+/* Per-request limits and hedging knobs, exposed as GUCs by gsheets.c */
+extern int http_connect_timeout;
+extern int http_request_timeout;
+extern int http_stall_timeout;
+extern int http_hedge_percentile;
+extern int http_hedge_min_delay;
+
+typedef struct HttpStats {
+    int64 requests;         /* requests completed successfully */
+    int64 hedged;           /* requests for which a duplicate was sent */
+    int64 hedge_wins;       /* hedged requests where the duplicate answered first */
+} HttpStats;
+
+/*
+ * Receives a response body chunk by chunk.  May ereport; the transfer is
+ * then aborted and the error rethrown once curl has been cleaned up.
+ */
+typedef void (*http_sink)(const char *data, size_t len, void *arg);
+
+typedef struct HttpSocket {
+    curl_socket_t fd;
+    int events;             /* WL_SOCKET_* flags curl is waiting for */
+} HttpSocket;
+
+/*
+ * Tracks the sockets and timer of a curl multi handle, so that a process can
+ * sleep on them and its latch at once.
+ */
+typedef struct HttpPoller {
+    CURLM *multi;
+    HttpSocket *sockets;
+    int nsockets;
+    int maxsockets;
+    bool sockets_changed;   /* wait_set must be rebuilt */
+    bool timer_set;
+    TimestampTz timer_deadline;
+    WaitEventSet *wait_set;
+    WaitEvent *occurred;
+    int nevents;
+} HttpPoller;
+
 void http_init(void);
 void http_cleanup(void);
 
 char *http_get(const char* url, char* params[], size_t params_count, struct curl_slist* headers);
 char *http_post(const char* url, const char* data, const char* params[], size_t params_count, struct curl_slist* headers);
 char *http_put(const char* url, const char* data, const char* params[], size_t params_count, struct curl_slist* headers);
+void http_get_stream(const char* url, char* params[], size_t params_count, struct curl_slist* headers,
+                     http_sink sink, void *arg);
+
+void http_poller_init(HttpPoller *poller, CURLM *multi);
+long http_poller_timeout(HttpPoller *poller, long max_ms);
+bool http_poller_wait(HttpPoller *poller, long timeout_ms, uint32 wait_event_info);
+void http_poller_release(HttpPoller *poller);
+
+char *url_encode(const char *str);
+
+const HttpStats *http_get_stats(void);
 
 struct curl_slist *add_header(struct curl_slist* headers,
                               const char* header_key,
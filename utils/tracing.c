@@ -0,0 +1,29 @@
+#include "postgres.h"
+#include "tracing.h"
+
+#include "utils/wait_event.h"
+
+#if PG_VERSION_NUM >= 170000
+static const char *const wait_event_names[NUM_WAIT_EVENTS] = {
+    [WAIT_HTTP_CONNECT] = "GSheetsHttpConnect",
+    [WAIT_HTTP_RESPONSE] = "GSheetsHttpResponse",
+    [WAIT_HTTP_TRANSFER] = "GSheetsHttpTransfer",
+    [WAIT_GATEWAY_REQUEST] = "GSheetsGatewayRequest",
+    [WAIT_GATEWAY_MAIN] = "GSheetsGatewayMain",
+    [WAIT_PARSE] = "GSheetsParse"
+};
+
+static uint32 wait_events[NUM_WAIT_EVENTS];
+#endif
+
+uint32 gsheets_wait_event(GSheetsWaitEvent event)
+{
+#if PG_VERSION_NUM >= 170000
+    /* Registered in shared memory on first use, by whichever process gets there first */
+    if (wait_events[event] == 0)
+        wait_events[event] = WaitEventExtensionNew(wait_event_names[event]);
+    return wait_events[event];
+#else
+    return PG_WAIT_EXTENSION;
+#endif
+}
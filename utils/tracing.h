@@ -0,0 +1,48 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+/*
+ * Wait events reported in pg_stat_activity while requests are in flight or
+ * responses are parsed.  On PostgreSQL 17 and later each gets its own name,
+ * before that they all show as "Extension".
+ */
+typedef enum GSheetsWaitEvent {
+    WAIT_HTTP_CONNECT,          /* resolving and connecting */
+    WAIT_HTTP_RESPONSE,         /* request sent, waiting for the first byte */
+    WAIT_HTTP_TRANSFER,         /* receiving the response body */
+    WAIT_GATEWAY_REQUEST,       /* waiting for the gateway worker */
+    WAIT_GATEWAY_MAIN,          /* gateway worker waiting for work or sockets */
+    WAIT_PARSE,                 /* parsing a JSON or CSV response */
+    NUM_WAIT_EVENTS
+} GSheetsWaitEvent;
+
+uint32 gsheets_wait_event(GSheetsWaitEvent event);
+
+/*
+ * Static tracepoints for perf, bpftrace or SystemTap (provider "gsheets").
+ * Built when the Makefile finds <sys/sdt.h>, no-ops otherwise.
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define TRACE_GSHEETS_HTTP_START(method, url) \
+    DTRACE_PROBE2(gsheets, http__start, method, url)
+#define TRACE_GSHEETS_HTTP_DONE(method, url, bytes) \
+    DTRACE_PROBE3(gsheets, http__done, method, url, bytes)
+#define TRACE_GSHEETS_PARSE_START(bytes) \
+    DTRACE_PROBE1(gsheets, parse__start, bytes)
+#define TRACE_GSHEETS_PARSE_DONE(bytes) \
+    DTRACE_PROBE1(gsheets, parse__done, bytes)
+#define TRACE_GSHEETS_WRITE_FLUSH(rows, bytes) \
+    DTRACE_PROBE2(gsheets, write__flush, rows, bytes)
+#define TRACE_GSHEETS_TUPLE_EMIT(rows) \
+    DTRACE_PROBE1(gsheets, tuple__emit, rows)
+#else
+#define TRACE_GSHEETS_HTTP_START(method, url) do {} while (0)
+#define TRACE_GSHEETS_HTTP_DONE(method, url, bytes) do {} while (0)
+#define TRACE_GSHEETS_PARSE_START(bytes) do {} while (0)
+#define TRACE_GSHEETS_PARSE_DONE(bytes) do {} while (0)
+#define TRACE_GSHEETS_WRITE_FLUSH(rows, bytes) do {} while (0)
+#define TRACE_GSHEETS_TUPLE_EMIT(rows) do {} while (0)
+#endif
+
+#endif // TRACING_H